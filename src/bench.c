@@ -0,0 +1,508 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "bench.h"
+#include "ts.h"
+#include "psi.h"
+#include "ts-gen.h"
+#include "replay.h"
+#include "stream.h"
+#include "rtp.h"
+#include "rec-prw.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BENCH_STALL 5000000 // us
+#define BENCH_TS_CHUNK 1024  // packets per call, ~ one read of the reactor
+
+typedef struct _BenchClients BenchClients;
+
+// HTTP clients of the stream server, read by one thread
+struct _BenchClients
+{
+	int epoll_fd;
+	int open;
+	uint64_t total;
+};
+
+static int64_t bench_cpu ( void )
+{
+	struct rusage ru;
+	getrusage ( RUSAGE_SELF, &ru );
+
+	return ( ru.ru_utime.tv_sec + ru.ru_stime.tv_sec ) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static gboolean bench_done ( Monitor **mon, uint32_t n )
+{
+	uint32_t i = 0; for ( i = 0; i < n; i++ )
+	{
+		MonitorStats st;
+		monitor_stats ( mon[i], &st );
+
+		// Datagrams a socket refused count as done
+		if ( !g_atomic_int_get ( &mon[i]->eof ) || st.size_file + st.fifo_drop < st.size_read ) return FALSE;
+	}
+
+	return TRUE;
+}
+
+static uint64_t bench_total ( Monitor **mon, uint32_t n )
+{
+	uint64_t total = 0;
+
+	uint32_t i = 0; for ( i = 0; i < n; i++ )
+	{
+		MonitorStats st;
+		monitor_stats ( mon[i], &st );
+
+		total += st.size_file + st.fifo_drop;
+	}
+
+	return total;
+}
+
+static gpointer bench_clients_read ( BenchClients *bc )
+{
+	struct epoll_event events[64];
+	uint8_t *buf = g_malloc ( 65536 );
+
+	while ( g_atomic_int_get ( &bc->open ) > 0 )
+	{
+		int n = epoll_wait ( bc->epoll_fd, events, 64, 100 );
+
+		int i = 0; for ( i = 0; i < n; i++ )
+		{
+			int fd = events[i].data.fd;
+			ssize_t r = 0;
+
+			while ( ( r = read ( fd, buf, 65536 ) ) > 0 ) bc->total += (uint64_t)r;
+
+			if ( r == 0 || ( r == -1 && errno != EAGAIN && errno != EINTR ) )
+			{
+				epoll_ctl ( bc->epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+				close ( fd );
+
+				g_atomic_int_add ( &bc->open, -1 );
+			}
+		}
+	}
+
+	free ( buf );
+
+	return NULL;
+}
+
+static gboolean bench_client_connect ( BenchClients *bc, uint32_t stream )
+{
+	int fd = socket ( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons ( STREAM_PORT ), .sin_addr.s_addr = htonl ( INADDR_LOOPBACK ) };
+
+	g_autofree char *req = g_strdup_printf ( "GET /bench/%u HTTP/1.0\r\n\r\n", stream );
+
+	if ( fd == -1 || connect ( fd, (struct sockaddr *)&addr, sizeof ( addr ) ) == -1 || write ( fd, req, strlen ( req ) ) == -1 )
+	{
+		perror ( "Bench client" );
+
+		if ( fd != -1 ) close ( fd );
+
+		return FALSE;
+	}
+
+	fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL ) | O_NONBLOCK );
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	epoll_ctl ( bc->epoll_fd, EPOLL_CTL_ADD, fd, &ev );
+	g_atomic_int_add ( &bc->open, 1 );
+
+	return TRUE;
+}
+
+// udp://host:port: stream i to port + i
+static char * bench_rec ( const char *dir, uint32_t i, uint32_t clients )
+{
+	if ( clients ) return g_strdup_printf ( "/bench/%u", i );
+
+	if ( !dir ) return g_strdup ( "/dev/null" );
+
+	if ( !rtp_uri ( dir ) ) return g_strdup_printf ( "%s/replay-%u.ts", dir, i );
+
+	const char *port = strrchr ( dir, ':' );
+
+	return g_strdup_printf ( "%.*s:%u", (int)( port - dir ), dir, (uint32_t)atoi ( port + 1 ) + i );
+}
+
+static int bench_run ( const char *ts, uint32_t n, uint32_t loops, gboolean pace, const char *dir, uint32_t clients, uint8_t writer )
+{
+	Monitor **mon = g_new0 ( Monitor *, n );
+
+	int64_t cpu = bench_cpu (), t1 = g_get_monotonic_time ();
+
+	uint32_t i = 0; for ( i = 0; i < n; i++ )
+	{
+		mon[i] = monitor_new ();
+		mon[i]->writer = writer;
+
+		g_autofree char *rec = bench_rec ( dir, i, clients );
+
+		const char *ret = ( clients ) ? replay_stream_create ( ts, pace, loops, rec, 0, NULL, mon[i] ) : replay_rec_create ( ts, pace, loops, rec, 0, NULL, mon[i] );
+
+		if ( ret )
+		{
+			g_printerr ( "%s: %s \n", rec, ret );
+
+			monitor_unref ( mon[i] );
+			n = i;
+
+			break;
+		}
+	}
+
+	BenchClients bc = { .epoll_fd = epoll_create1 ( EPOLL_CLOEXEC ) };
+	GThread *thread = NULL;
+
+	for ( i = 0; clients && i < n * clients; i++ ) if ( !bench_client_connect ( &bc, i % n ) ) break;
+
+	if ( clients )
+	{
+		thread = g_thread_new ( "bench-clients", (GThreadFunc)bench_clients_read, &bc );
+
+		// The server hands the clients over to the writer before the replay starts
+		g_usleep ( 200000 );
+
+		cpu = bench_cpu (); t1 = g_get_monotonic_time ();
+	}
+
+	replay_rec_start ();
+
+	uint64_t last = 0;
+	int64_t t_last = t1;
+
+	while ( n && !bench_done ( mon, n ) )
+	{
+		g_usleep ( 10000 );
+
+		uint64_t total = bench_total ( mon, n );
+
+		if ( total != last ) { last = total; t_last = g_get_monotonic_time (); }
+
+		if ( g_get_monotonic_time () - t_last > BENCH_STALL ) { g_printerr ( "Stalled, giving up \n" ); break; }
+	}
+
+	int64_t wall = g_get_monotonic_time () - t1;
+	cpu = bench_cpu () - cpu;
+
+	uint64_t total = 0, packets = 0, drop = 0, fifo_drop = 0, cc = 0;
+	uint32_t p50 = 0, p99 = 0, max = 0;
+
+	for ( i = 0; i < n; i++ )
+	{
+		MonitorStats st;
+		monitor_stats ( mon[i], &st );
+
+		total   += st.size_file;
+		packets += st.packets;
+		drop    += st.ring_drop;
+		fifo_drop += st.fifo_drop;
+		cc      += st.cc_error;
+
+		p50 = MAX ( p50, st.lat_p50 );
+		p99 = MAX ( p99, st.lat_p99 );
+		max = MAX ( max, st.lat_max );
+	}
+
+	double sec = (double)MAX ( wall, 1 ) / 1000000;
+
+	g_print ( "%3u streams: %8.1f MB/s  %6.2f Mpkt/s  CPU %5.1f %% per stream  write p50 %u p99 %u max %u us  drop %" G_GUINT64_FORMAT " B  CC %" G_GUINT64_FORMAT " \n",
+		n, (double)total / sec / 1e6, (double)packets / sec / 1e6, ( n ) ? (double)cpu / (double)MAX ( wall, 1 ) * 100 / n : 0, p50, p99, max, drop, cc );
+
+	for ( i = 0; i < n; i++ ) { dmx_rec_prw_stop ( mon[i] ); monitor_unref ( mon[i] ); }
+
+	if ( thread )
+	{
+		// Stopped streams close their clients
+		g_thread_join ( thread );
+
+		g_print ( "%3u streams x %u clients: %8.1f MB/s read by the clients  drop %" G_GUINT64_FORMAT " B \n",
+			n, clients, (double)bc.total / sec / 1e6, fifo_drop );
+	}
+
+	if ( !clients && dir && rtp_uri ( dir ) ) g_print ( "%3u streams: %" G_GUINT64_FORMAT " B not sent \n", n, fifo_drop );
+
+	close ( bc.epoll_fd );
+	free ( mon );
+
+	return ( n ) ? 0 : 1;
+}
+
+int bench_replay ( const char *ts, const char *streams, uint32_t loops, gboolean pace, const char *dir, uint32_t clients, uint8_t writer )
+{
+	char **list = g_strsplit ( ( streams ) ? streams : "1,8,32", ",", 0 );
+
+	int ret = 0;
+
+	uint8_t i = 0; for ( i = 0; list[i]; i++ )
+	{
+		uint32_t n = (uint32_t)atoi ( list[i] );
+
+		if ( n ) ret |= bench_run ( ts, n, loops, pace, dir, clients, writer );
+	}
+
+	g_strfreev ( list );
+
+	return ret;
+}
+
+// ***** PSI *****
+
+typedef struct _BenchPsi BenchPsi;
+
+struct _BenchPsi
+{
+	Psi *psi[MAX_PID];
+	uint64_t bytes;
+};
+
+static void bench_psi_add ( BenchPsi *bp, uint16_t pid )
+{
+	if ( bp->psi[pid] ) return;
+
+	bp->psi[pid] = g_new ( Psi, 1 );
+	psi_init ( bp->psi[pid], pid );
+}
+
+// PAT: the PMTs join the parse
+static void bench_psi_section ( uint16_t pid, const uint8_t *sec, uint32_t len, BenchPsi *bp )
+{
+	bp->bytes += len;
+
+	if ( pid != 0 || sec[0] != 0 ) return;
+
+	uint32_t off = 0; for ( off = 8; off + 4 <= len - 4; off += 4 )
+		if ( sec[off] || sec[off + 1] ) bench_psi_add ( bp, (uint16_t)( ( ( sec[off + 2] & 0x1F ) << 8 ) | sec[off + 3] ) );
+}
+
+static uint64_t bench_psi_count ( const BenchPsi *bp )
+{
+	uint64_t sections = 0;
+
+	uint32_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ )
+	{
+		if ( bp->psi[pid] ) sections += bp->psi[pid]->n_section + bp->psi[pid]->n_unchanged;
+	}
+
+	return sections;
+}
+
+// Every PSI packet of the stream, loops times; reset: forget the versions at every packet, each section is checked
+static double bench_psi_run ( BenchPsi *bp, const uint8_t *buf, uint32_t n, uint32_t loops, gboolean reset, uint64_t *sections )
+{
+	uint64_t count = bench_psi_count ( bp );
+	int64_t t1 = g_get_monotonic_time ();
+
+	uint32_t l = 0; for ( l = 0; l < loops; l++ )
+	{
+		uint32_t i = 0; for ( i = 0; i < n; i++ )
+		{
+			const uint8_t *pkt = buf + (gsize)i * TS_SIZE;
+			Psi *psi = bp->psi[( ( pkt[1] & 0x1F ) << 8 ) | pkt[2]];
+
+			if ( !psi ) continue;
+
+			if ( reset ) psi_reset ( psi );
+
+			psi_push ( psi, pkt, (PsiFunc)bench_psi_section, bp );
+		}
+	}
+
+	double sec = (double)MAX ( g_get_monotonic_time () - t1, 1 ) / 1000000;
+
+	*sections = bench_psi_count ( bp ) - count;
+
+	return sec;
+}
+
+static uint8_t * bench_load ( const char *ts, uint32_t *n )
+{
+	if ( g_str_has_prefix ( ts, REPLAY_GEN ) )
+	{
+		const char *error = NULL;
+		TsGen *gen = ts_gen_new ( ts + strlen ( REPLAY_GEN ), &error );
+
+		if ( !gen ) { g_printerr ( "%s \n", error ); return NULL; }
+
+		// 10 s of stream
+		*n = ts_gen_rate ( gen ) * 10;
+
+		uint8_t *buf = g_malloc ( (gsize)*n * TS_SIZE );
+		ts_gen_fill ( gen, buf, *n );
+		ts_gen_free ( gen );
+
+		return buf;
+	}
+
+	char *data = NULL;
+	gsize len = 0;
+	GError *error = NULL;
+
+	if ( !g_file_get_contents ( ts, &data, &len, &error ) ) { g_printerr ( "%s \n", error->message ); g_error_free ( error ); return NULL; }
+
+	// The packets in sync only: resynced at every gap, as dmx_source_read ( ) does
+	uint32_t size = (uint32_t)MIN ( len, G_MAXUINT32 ), off = ts_sync ( (uint8_t *)data, size ), m = 0;
+
+	while ( off + TS_SIZE <= size )
+	{
+		if ( (uint8_t)data[off] != TS_SYNC ) { off += 1 + ts_sync ( (uint8_t *)data + off + 1, size - off - 1 ); continue; }
+
+		memmove ( data + (gsize)m++ * TS_SIZE, data + off, TS_SIZE );
+		off += TS_SIZE;
+	}
+
+	*n = m;
+
+	return (uint8_t *)data;
+}
+
+int bench_psi ( const char *ts, uint32_t loops )
+{
+	uint32_t n = 0;
+	uint8_t *buf = bench_load ( ts, &n );
+
+	if ( !buf ) return 1;
+
+	BenchPsi *bp = g_new0 ( BenchPsi, 1 );
+
+	// PAT, NIT, SDT / BAT, EIT, TDT / TOT
+	uint16_t pids[] = { 0x00, 0x10, 0x11, 0x12, 0x14 };
+
+	uint8_t c = 0; for ( c = 0; c < G_N_ELEMENTS ( pids ); c++ ) bench_psi_add ( bp, pids[c] );
+
+	// One pass to find the PMTs, then the PSI packets only
+	uint64_t skipped = 0, checked = 0, crc_error = 0;
+	bench_psi_run ( bp, buf, n, 1, FALSE, &skipped );
+
+	uint32_t i = 0, m = 0; for ( i = 0; i < n; i++ )
+	{
+		const uint8_t *pkt = buf + (gsize)i * TS_SIZE;
+
+		if ( bp->psi[( ( pkt[1] & 0x1F ) << 8 ) | pkt[2]] ) memmove ( buf + (gsize)m++ * TS_SIZE, pkt, TS_SIZE );
+	}
+
+	n = m;
+
+	double sec_skip  = bench_psi_run ( bp, buf, n, loops, FALSE, &skipped );
+	double sec_check = bench_psi_run ( bp, buf, n, loops, TRUE,  &checked );
+
+	uint32_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ ) if ( bp->psi[pid] ) crc_error += bp->psi[pid]->n_crc_error;
+
+	// CRC alone, on 4 KB sections
+	uint8_t *blk = g_malloc0 ( PSI_SECTION_MAX );
+	uint32_t crc = 0, k = 0;
+	int64_t t1 = g_get_monotonic_time ();
+
+	for ( k = 0; k < 100000; k++ ) { blk[0] = (uint8_t)k; crc += psi_crc32 ( blk, PSI_SECTION_MAX ); }
+
+	double sec_crc = (double)MAX ( g_get_monotonic_time () - t1, 1 ) / 1000000;
+
+	g_print ( "PSI: %u PSI packets x %u loops, %" G_GUINT64_FORMAT " sections per loop, %" G_GUINT64_FORMAT " CRC errors \n",
+		n, loops, checked / loops, crc_error );
+	g_print ( "  versions skipped: %8.2f M sections/s  %8.1f Mpkt/s \n", (double)skipped / sec_skip / 1e6, (double)n * loops / sec_skip / 1e6 );
+	g_print ( "  every CRC:        %8.2f M sections/s  %8.1f Mpkt/s \n", (double)checked / sec_check / 1e6, (double)n * loops / sec_check / 1e6 );
+	g_print ( "  CRC32 slice-by-8: %8.1f MB/s ( %08x ) \n", (double)k * PSI_SECTION_MAX / sec_crc / 1e6, crc );
+
+	for ( pid = 0; pid < MAX_PID; pid++ ) free ( bp->psi[pid] );
+
+	free ( blk );
+	free ( bp );
+	free ( buf );
+
+	return 0;
+}
+
+// route: ts_route ( ) on the PIDs of the parse, got: packets parsed per chunk ( up to a lost sync ); count: packets parsed or routed
+static double bench_ts_run ( uint8_t simd, gboolean route, const uint8_t *buf, uint32_t n, uint32_t loops, const uint32_t *bitmap, uint16_t *pids, uint32_t *got, uint16_t *index, uint64_t *count )
+{
+	uint64_t c = 0;
+	int64_t t1 = g_get_monotonic_time ();
+
+	uint32_t l = 0; for ( l = 0; l < loops; l++ )
+	{
+		uint32_t i = 0; for ( i = 0; i < n; i += BENCH_TS_CHUNK )
+		{
+			uint32_t k = MIN ( BENCH_TS_CHUNK, n - i );
+
+			if ( route )
+				c += ts_route_simd ( simd, pids + i, got[i / BENCH_TS_CHUNK], bitmap, index );
+			else
+				c += got[i / BENCH_TS_CHUNK] = ts_parse_simd ( simd, buf + (gsize)i * TS_SIZE, k, pids + i );
+		}
+	}
+
+	*count = c;
+
+	return (double)MAX ( g_get_monotonic_time () - t1, 1 ) / 1000000;
+}
+
+int bench_ts ( const char *ts, uint32_t loops )
+{
+	uint32_t n = 0;
+	uint8_t *buf = bench_load ( ts, &n );
+
+	if ( !buf ) return 1;
+
+	uint16_t *pids  = g_new0 ( uint16_t, MAX ( n, 1 ) );
+	uint32_t *got   = g_new0 ( uint32_t, n / BENCH_TS_CHUNK + 1 );
+	uint16_t *index = g_new ( uint16_t, BENCH_TS_CHUNK );
+	uint32_t bitmap[MAX_PID / 32] = { 0 };
+
+	// A recording of part of the mux: the even PIDs
+	uint32_t i = 0, m = ts_parse_simd ( TS_SIMD_NONE, buf, n, pids );
+
+	for ( i = 0; i < m; i++ ) if ( !( pids[i] & 1 ) ) ts_bitmap_set ( bitmap, pids[i] );
+
+	g_print ( "TS: %u packets x %u loops \n", n, loops );
+
+	const char *name[] = { "scalar", "sse2", "avx2" };
+	uint64_t parsed_ref = 0, routed_ref = 0;
+
+	uint8_t simd = 0; for ( simd = TS_SIMD_NONE; simd <= ts_simd (); simd++ )
+	{
+		uint64_t parsed = 0, routed = 0;
+
+		double sec_parse = bench_ts_run ( simd, FALSE, buf, n, loops, bitmap, pids, got, index, &parsed );
+		double sec_route = bench_ts_run ( simd, TRUE,  buf, n, loops, bitmap, pids, got, index, &routed );
+
+		if ( simd == TS_SIMD_NONE ) { parsed_ref = parsed; routed_ref = routed; }
+
+		// sse2: ts_route ( ) is the scalar one
+		g_print ( "  %-6s  ts_parse %8.1f Mpkt/s  ts_route %8.1f Mpkt/s%s \n", name[simd], (double)n * loops / sec_parse / 1e6, (double)n * loops / sec_route / 1e6,
+			( parsed != parsed_ref || routed != routed_ref ) ? "  mismatch" : "" );
+	}
+
+	free ( index );
+	free ( got );
+	free ( pids );
+	free ( buf );
+
+	return 0;
+}
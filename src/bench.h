@@ -0,0 +1,23 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+// Headless run of the capture engine on a replayed TS; streams: "1,8,32"
+// clients: serve every stream on the loopback stream server to that many HTTP clients instead of writing it
+// writer: the enum rec_writer of the recordings
+int bench_replay ( const char *ts, const char *streams, uint32_t loops, gboolean pace, const char *dir, uint32_t clients, uint8_t writer );
+
+// Section reassembly and CRC of the PSI PIDs of ts ( or REPLAY_GEN "spec" ), in memory
+int bench_psi ( const char *ts, uint32_t loops );
+
+// ts_parse ( ), ts_route ( ) of ts ( or REPLAY_GEN "spec" ) in memory: scalar and every SIMD level of this CPU
+int bench_ts ( const char *ts, uint32_t loops );
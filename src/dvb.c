@@ -8,6 +8,26 @@
 */
 
 #include "dvb.h"
+#include "scan.h"
+#include "scan-cache.h"
+#include "scan-lock.h"
+
+#define DVB_TUNERS 16
+
+typedef struct _DvbTuner DvbTuner;
+
+struct _DvbTuner
+{
+	Dvb *dvb;
+	ScanQueue *queue;
+
+	struct dvb_device *dev;
+	char *demux_dev;
+
+	struct dvb_file *file_new; // channels found by this tuner
+	uint32_t group; // LNB band / polarization of the last transponder
+	GThread *thread;
+};
 
 struct _Dvb
 {
@@ -24,6 +44,16 @@ struct _Dvb
 	uint8_t new_freqs, get_detect, get_nit, other_nit;
 	int8_t lna, lnb, sat_num;
 
+	// Scan: tuner[0] is dvb_scan, the others are free adapters of the same delivery system
+	uint8_t tuners, n_tuner;
+	DvbTuner tuner[DVB_TUNERS];
+
+	uint8_t scan_cache;
+	ScanCache *cache; // shared by the tuners, NULL: off
+
+	uint8_t scan_adapt;
+	ScanLock *lock; // adaptive lock wait, NULL: off
+
 	uint8_t descr_num;
 	uint16_t pids[3]; // 0 - sid, 1 - vpid, 2 - apid
 
@@ -73,165 +103,258 @@ static int _check_frontend ( G_GNUC_UNUSED void *__args, G_GNUC_UNUSED struct dv
 	return 0;
 }
 
-static gpointer dvb_scan_thread ( Dvb *dvb_base )
+static void dvb_scan_free_tuners ( Dvb *dvb )
 {
-	struct dvb_device *dvb = dvb_base->dvb_scan;
-	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	struct dvb_file *dvb_file = NULL, *dvb_file_new = NULL;
-	struct dvb_entry *entry;
-	struct dvb_open_descriptor *dmx_fd;
+	g_mutex_lock ( &dvb->mutex );
 
-	g_mutex_init ( &dvb_base->mutex );
+	uint8_t i = 0; for ( i = 0; i < dvb->n_tuner; i++ ) dvb_dev_free ( dvb->tuner[i].dev );
 
-	int count = 0, shift;
-	uint32_t freq = 0, sys = _get_delsys ( parms );
+	dvb->n_tuner   = 0;
+	dvb->dvb_scan  = NULL;
+	dvb->demux_dev = NULL;
 
-	enum dvb_sat_polarization pol;
+	g_mutex_unlock ( &dvb->mutex );
+}
 
-	dvb_file = dvb_read_file_format ( dvb_base->input_file, sys, dvb_base->input_format );
+static gpointer dvb_scan_tuner ( DvbTuner *tuner )
+{
+	Dvb *dvb_base = tuner->dvb;
+	struct dvb_v5_fe_parms *parms = tuner->dev->fe_parms;
+	struct dvb_open_descriptor *dmx_fd = dvb_dev_open ( tuner->dev, tuner->demux_dev, O_RDWR );
 
-	if ( !dvb_file )
-	{
-		dvb_dev_free ( dvb );
-		dvb_base->dvb_scan  = NULL;
-		dvb_base->demux_dev = NULL;
+	if ( !dmx_fd ) { perror ( "opening demux failed" ); return NULL; }
 
-		g_mutex_clear ( &dvb_base->mutex );
-		g_warning ( "%s:: Read file format failed.", __func__ );
-		return NULL;
-	}
+	struct dvb_entry *entry = NULL;
+	uint32_t freq = 0, count = 0;
 
-	dmx_fd = dvb_dev_open ( dvb, dvb_base->demux_dev, O_RDWR );
+	uint32_t group = 0;
 
-	if ( !dmx_fd )
+	while ( ( entry = scan_queue_next ( tuner->queue, &tuner->group, &freq, &count ) ) )
 	{
-		dvb_file_free ( dvb_file );
-		dvb_dev_free ( dvb );
-		dvb_base->dvb_scan  = NULL;
-		dvb_base->demux_dev = NULL;
-
-		g_mutex_clear ( &dvb_base->mutex );
-		perror ( "opening demux failed" );
-		return NULL;
-	}
+		int8_t sw = ( group ) ? ( group != tuner->group ) : -1;
+		group = tuner->group;
 
-	for ( entry = dvb_file->first_entry; entry != NULL; entry = entry->next )
-	{
 		struct dvb_v5_descriptors *dvb_scan_handler = NULL;
-		uint32_t stream_id;
-
-		if ( dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &freq ) ) continue;
-
-		shift = dvb_estimate_freq_shift ( parms );
-
-		if ( dvb_retrieve_entry_prop ( entry, DTV_POLARIZATION, &pol ) ) pol = POLARIZATION_OFF;
-		if ( dvb_retrieve_entry_prop ( entry, DTV_STREAM_ID, &stream_id ) ) stream_id = NO_STREAM_ID_FILTER;
-		if ( !dvb_new_entry_is_needed ( dvb_file->first_entry, entry, freq, shift, pol, stream_id ) ) continue;
 
-		count++;
 		dvb_log ( "Scanning frequency #%d %d", count, freq );
 
 		g_mutex_lock ( &dvb_base->mutex );
 			dvb_base->freq_scan = freq;
 		g_mutex_unlock ( &dvb_base->mutex );
 
-		dvb_scan_handler = dvb_dev_scan ( dmx_fd, entry, &_check_frontend, NULL, dvb_base->other_nit, dvb_base->time_mult );
+		struct dvb_file *dvb_file_tp = NULL;
+
+		ScanLockTp tp;
+		uint8_t time_mult = ( dvb_base->lock ) ? scan_lock_start ( dvb_base->lock, &tp, freq, sw ) : dvb_base->time_mult;
+
+		check_frontend_t *check = ( dvb_base->lock ) ? &scan_lock_check : &_check_frontend;
+		void *args = ( dvb_base->lock ) ? &tp : NULL;
+
+		// The PAT, SDT ( NIT ) of a cached transponder unchanged: its channels without the PMT reads
+		if ( dvb_base->cache && scan_cache_has ( dvb_base->cache, parms, entry ) )
+		{
+			dvb_scan_handler = scan_cache_probe ( parms, dmx_fd, entry, time_mult, !dvb_base->new_freqs || dvb_base->get_nit, check, args );
+
+			if ( dvb_scan_handler ) dvb_file_tp = scan_cache_get ( dvb_base->cache, parms, entry, dvb_scan_handler );
+
+			if ( !dvb_file_tp && dvb_scan_handler ) { dvb_scan_free_handler_table ( dvb_scan_handler ); dvb_scan_handler = NULL; }
+		}
+
+		if ( !dvb_file_tp ) dvb_scan_handler = dvb_dev_scan ( dmx_fd, entry, check, args, dvb_base->other_nit, time_mult );
+
+		if ( dvb_base->lock ) scan_lock_done ( &tp, ( dvb_scan_handler != NULL ) );
+
+		int progs = ( dvb_scan_handler ) ? dvb_scan_handler->num_program : 0;
+
+		if ( dvb_file_tp ) { progs = 0; struct dvb_entry *e = NULL; for ( e = dvb_file_tp->first_entry; e; e = e->next ) progs++; }
 
 		g_mutex_lock ( &dvb_base->mutex );
-			if ( dvb_scan_handler ) dvb_base->progs_scan += dvb_scan_handler->num_program;
+			dvb_base->progs_scan += (uint32_t)progs;
 			if ( dvb_base->thread_stop ) parms->abort = 1;
 		g_mutex_unlock ( &dvb_base->mutex );
 
+		scan_queue_done ( tuner->queue, parms, ( parms->abort || dvb_base->new_freqs ) ? NULL : dvb_scan_handler, entry );
+
 		if ( parms->abort )
 		{
-			dvb_scan_free_handler_table ( dvb_scan_handler );
+			scan_queue_stop ( tuner->queue );
+			if ( dvb_scan_handler ) dvb_scan_free_handler_table ( dvb_scan_handler );
+			if ( dvb_file_tp ) dvb_file_free ( dvb_file_tp );
 			break;
 		}
 
-		if ( !dvb_scan_handler ) continue;
+		if ( !dvb_scan_handler ) { if ( dvb_file_tp ) dvb_file_free ( dvb_file_tp ); continue; }
+
+		if ( !dvb_file_tp )
+		{
+			dvb_store_channel ( &dvb_file_tp, parms, dvb_scan_handler, dvb_base->get_detect, dvb_base->get_nit );
 
-		dvb_store_channel ( &dvb_file_new, parms, dvb_scan_handler, dvb_base->get_detect, dvb_base->get_nit );
+			if ( dvb_base->cache ) scan_cache_put ( dvb_base->cache, parms, entry, dvb_scan_handler, dvb_file_tp );
+		}
 
-		if ( !dvb_base->new_freqs ) dvb_add_scaned_transponders ( parms, dvb_scan_handler, dvb_file->first_entry, entry );
+		scan_file_append ( &tuner->file_new, dvb_file_tp );
 
 		dvb_scan_free_handler_table ( dvb_scan_handler );
 	}
 
+	dvb_dev_close ( dmx_fd );
+
+	return NULL;
+}
+
+static gpointer dvb_scan_thread ( Dvb *dvb_base )
+{
+	struct dvb_v5_fe_parms *parms = dvb_base->dvb_scan->fe_parms;
+	struct dvb_file *dvb_file = NULL, *dvb_file_new = NULL;
+
+	uint32_t sys = _get_delsys ( parms );
+
+	dvb_file = dvb_read_file_format ( dvb_base->input_file, sys, dvb_base->input_format );
+
+	if ( !dvb_file )
+	{
+		dvb_scan_free_tuners ( dvb_base );
+
+		g_warning ( "%s:: Read file format failed.", __func__ );
+		return NULL;
+	}
+
+	// One queue: a transponder is scanned by whichever tuner is free first
+	ScanQueue *queue = scan_queue_new ( dvb_file, parms );
+
+	dvb_base->cache = ( dvb_base->scan_cache ) ? scan_cache_new ( dvb_base->get_detect, dvb_base->get_nit ) : NULL;
+	dvb_base->lock  = ( dvb_base->scan_adapt ) ? scan_lock_new ( dvb_base->time_mult ) : NULL;
+
+	uint8_t i = 0; for ( i = 0; i < dvb_base->n_tuner; i++ )
+	{
+		DvbTuner *tuner = &dvb_base->tuner[i];
+
+		tuner->queue = queue;
+		tuner->file_new = NULL;
+		tuner->group = 0;
+
+		if ( i ) tuner->thread = g_thread_new ( "scan-tuner", (GThreadFunc)dvb_scan_tuner, tuner );
+	}
+
+	dvb_scan_tuner ( &dvb_base->tuner[0] );
+
+	struct dvb_file *files[DVB_TUNERS];
+
+	for ( i = 0; i < dvb_base->n_tuner; i++ )
+	{
+		if ( i ) g_thread_join ( dvb_base->tuner[i].thread );
+
+		files[i] = dvb_base->tuner[i].file_new;
+		dvb_base->tuner[i].file_new = NULL;
+	}
+
+	dvb_file_new = scan_merge ( files, dvb_base->n_tuner );
+
 	if ( dvb_file_new ) dvb_write_file_format ( dvb_base->output_file, dvb_file_new, parms->current_sys, dvb_base->output_format );
 
+	scan_queue_report ( queue, ( dvb_base->lock ) ? scan_lock_switch ( dvb_base->lock ) : -1 );
+	scan_queue_free ( queue );
+
+	if ( dvb_base->cache ) scan_cache_free ( dvb_base->cache );
+	dvb_base->cache = NULL;
+
+	if ( dvb_base->lock ) { scan_lock_report ( dvb_base->lock ); scan_lock_free ( dvb_base->lock ); }
+	dvb_base->lock = NULL;
+
 	dvb_file_free ( dvb_file );
 	if ( dvb_file_new ) dvb_file_free ( dvb_file_new );
 
-	dvb_dev_close ( dmx_fd );
-
 	g_mutex_lock ( &dvb_base->mutex );
 		dvb_base->freq_scan = 0;
 		dvb_base->thread_stop = 1;
 	g_mutex_unlock ( &dvb_base->mutex );
 
-	g_mutex_clear ( &dvb_base->mutex );
-
 	g_signal_emit_by_name ( dvb_base, "dvb-scan-done" );
 
-	dvb_dev_free ( dvb );
-	dvb_base->dvb_scan  = NULL;
-	dvb_base->demux_dev = NULL;
+	dvb_scan_free_tuners ( dvb_base );
 
 	return NULL;
 }
 
-static const char * dvb_scan ( Dvb *dvb )
+static struct dvb_device * dvb_scan_open ( uint8_t a, uint8_t f, uint8_t d, char **demux_dev, const char **error )
 {
-	dvb->thread_stop = 0;
+	struct dvb_device *dev = dvb_dev_alloc ();
 
-	dvb->dvb_scan = dvb_dev_alloc ();
+	if ( !dev ) { *error = "Allocates memory failed."; return NULL; }
 
-	if ( !dvb->dvb_scan ) return "Allocates memory failed.";
+	dvb_dev_set_log ( dev, 0, NULL );
+	dvb_dev_find ( dev, NULL, NULL );
 
-	dvb_dev_set_log ( dvb->dvb_scan, 0, NULL );
-	dvb_dev_find ( dvb->dvb_scan, NULL, NULL );
+	struct dvb_dev_list *dvb_dev = dvb_dev_seek_by_adapter ( dev, a, d, DVB_DEVICE_DEMUX );
 
-	struct dvb_dev_list *dvb_dev = dvb_dev_seek_by_adapter ( dvb->dvb_scan, dvb->adapter, dvb->demux, DVB_DEVICE_DEMUX );
+	if ( !dvb_dev ) { dvb_dev_free ( dev ); *error = "Couldn't find demux device."; return NULL; }
 
-	if ( !dvb_dev )
-	{
-		dvb_dev_free ( dvb->dvb_scan );
-		dvb->dvb_scan = NULL;
+	*demux_dev = dvb_dev->sysname;
 
-		g_warning ( "%s:: Couldn't find demux device node.", __func__ );
-		return "Couldn't find demux device.";
-	}
+	dvb_dev = dvb_dev_seek_by_adapter ( dev, a, f, DVB_DEVICE_FRONTEND );
 
-	dvb->demux_dev = dvb_dev->sysname;
-	g_message ( "%s:: demux_dev: %s ", __func__, dvb->demux_dev );
+	if ( !dvb_dev ) { dvb_dev_free ( dev ); *error = "Couldn't find frontend device."; return NULL; }
 
-	dvb_dev = dvb_dev_seek_by_adapter ( dvb->dvb_scan, dvb->adapter, dvb->frontend, DVB_DEVICE_FRONTEND );
+	// A frontend in use by another program is busy
+	if ( !dvb_dev_open ( dev, dvb_dev->sysname, O_RDWR ) ) { dvb_dev_free ( dev ); *error = "Opening device failed."; return NULL; }
 
-	if ( !dvb_dev )
-	{
-		dvb_dev_free ( dvb->dvb_scan );
-		dvb->dvb_scan = NULL;
+	return dev;
+}
 
-		g_warning ( "%s:: Couldn't find frontend device.", __func__ );
-		return "Couldn't find frontend device.";
-	}
+static void dvb_scan_set_parms ( struct dvb_v5_fe_parms *parms, Dvb *dvb )
+{
+	if ( dvb->lnb >= 0 ) parms->lnb = dvb_sat_get_lnb ( dvb->lnb );
+	if ( dvb->sat_num >= 0 ) parms->sat_number = dvb->sat_num;
+	parms->diseqc_wait = dvb->diseqc_wait;
+	parms->lna = dvb->lna;
+	parms->freq_bpf = 0;
+}
+
+// Frontend 0, demux 0 of the other adapters, while they are free and tune the same delivery system
+static void dvb_scan_add_tuners ( Dvb *dvb )
+{
+	uint32_t sys = _get_delsys ( dvb->dvb_scan->fe_parms );
 
-	if ( !dvb_dev_open ( dvb->dvb_scan, dvb_dev->sysname, O_RDWR ) )
+	uint8_t a = 0; for ( a = 0; a < DVB_TUNERS && dvb->n_tuner < dvb->tuners; a++ )
 	{
-		dvb_dev_free ( dvb->dvb_scan );
-		dvb->dvb_scan = NULL;
+		if ( a == dvb->adapter ) continue;
 
-		perror ( "Opening device failed" );
-		return "Opening device failed.";
+		char *demux_dev = NULL;
+		const char *error = NULL;
+		struct dvb_device *dev = dvb_scan_open ( a, 0, 0, &demux_dev, &error );
+
+		if ( !dev ) continue;
+
+		if ( _get_delsys ( dev->fe_parms ) != sys ) { dvb_dev_free ( dev ); continue; }
+
+		dvb_scan_set_parms ( dev->fe_parms, dvb );
+
+		dvb->tuner[dvb->n_tuner++] = (DvbTuner){ .dvb = dvb, .dev = dev, .demux_dev = demux_dev };
+
+		g_message ( "%s:: adapter%u: %s ", __func__, a, demux_dev );
 	}
+}
 
-	struct dvb_v5_fe_parms *parms = dvb->dvb_scan->fe_parms;
+static const char * dvb_scan ( Dvb *dvb )
+{
+	dvb->thread_stop = 0;
 
-	if ( dvb->lnb >= 0 ) parms->lnb = dvb_sat_get_lnb ( dvb->lnb );
-	if ( dvb->sat_num >= 0 ) parms->sat_number = dvb->sat_num;
-	parms->diseqc_wait = dvb->diseqc_wait;
-	parms->lna = dvb->lna;
-	parms->freq_bpf = 0;
+	const char *error = NULL;
+	char *demux_dev = NULL;
+
+	dvb->dvb_scan = dvb_scan_open ( dvb->adapter, dvb->frontend, dvb->demux, &demux_dev, &error );
+
+	if ( !dvb->dvb_scan ) { g_warning ( "%s:: %s", __func__, error ); return error; }
+
+	dvb->demux_dev = demux_dev;
+	g_message ( "%s:: demux_dev: %s ", __func__, dvb->demux_dev );
+
+	dvb_scan_set_parms ( dvb->dvb_scan->fe_parms, dvb );
+
+	dvb->n_tuner = 0;
+	dvb->tuner[dvb->n_tuner++] = (DvbTuner){ .dvb = dvb, .dev = dvb->dvb_scan, .demux_dev = demux_dev };
+
+	if ( dvb->tuners > 1 ) dvb_scan_add_tuners ( dvb );
 
 	dvb->freq_scan  = 0;
 	dvb->progs_scan = 0;
@@ -243,7 +366,7 @@ static const char * dvb_scan ( Dvb *dvb )
 }
 
 static void dvb_handler_scan ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_t t, uint8_t q, uint8_t c, uint8_t n, uint8_t o, 
-	int8_t sn, uint8_t dq, const char *lnb_name, const char *lna, const char *fi, const char *fo, const char *fmi, const char *fmo )
+	int8_t sn, uint8_t dq, const char *lnb_name, const char *lna, const char *fi, const char *fo, const char *fmi, const char *fmo, uint8_t tn, uint8_t ch, uint8_t ad )
 {
 	if ( dvb->dvb_scan || dvb->dvb_zap ) { g_signal_emit_by_name ( dvb, "dvb-scan-info", "It works ..." ); return; }
 
@@ -251,6 +374,9 @@ static void dvb_handler_scan ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_
 	dvb->frontend  = f;
 	dvb->demux     = d;
 	dvb->time_mult = t;
+	dvb->tuners    = MIN ( MAX ( tn, 1 ), DVB_TUNERS );
+	dvb->scan_cache = ch;
+	dvb->scan_adapt = ad;
 
 	dvb->new_freqs  = q;
 	dvb->get_detect = c;
@@ -285,7 +411,17 @@ static void dvb_handler_scan ( Dvb *dvb, uint8_t a, uint8_t f, uint8_t d, uint8_
 
 static void dvb_handler_scan_stop ( Dvb *dvb )
 {
-	if ( dvb->dvb_scan ) dvb->thread_stop = 1;
+	g_mutex_lock ( &dvb->mutex );
+
+	if ( dvb->dvb_scan )
+	{
+		dvb->thread_stop = 1;
+
+		// Every tuner: libdvbv5 gives up the table it waits for
+		uint8_t i = 0; for ( i = 0; i < dvb->n_tuner; i++ ) dvb->tuner[i].dev->fe_parms->abort = 1;
+	}
+
+	g_mutex_unlock ( &dvb->mutex );
 }
 
 static uint8_t dvb_zap_parse ( const char *file, const char *channel, uint8_t frm, struct dvb_v5_fe_parms *parms, uint16_t pids[] )
@@ -757,6 +893,8 @@ static void dvb_handler_dvb_msec ( Dvb *dvb, uint16_t msec )
 
 static void dvb_init ( Dvb *dvb )
 {
+	g_mutex_init ( &dvb->mutex );
+
 	dvb->dvb_fe = NULL;
 	dvb->dvb_zap = NULL;
 	dvb->dvb_scan = NULL;
@@ -765,6 +903,14 @@ static void dvb_init ( Dvb *dvb )
 	dvb->frontend  = 0;
 	dvb->demux     = 0;
 	dvb->time_mult = 2;
+	dvb->tuners    = 1;
+	dvb->n_tuner   = 0;
+
+	dvb->scan_cache = 0;
+	dvb->cache = NULL;
+
+	dvb->scan_adapt = 0;
+	dvb->lock = NULL;
 
 	dvb->new_freqs  = 0;
 	dvb->get_detect = 0;
@@ -810,6 +956,8 @@ static void dvb_finalize ( GObject *object )
 
 	g_source_remove ( dvb->src_tm );
 
+	g_mutex_clear ( &dvb->mutex );
+
 	if ( dvb->input_file  ) free ( dvb->input_file  );
 	if ( dvb->output_file ) free ( dvb->output_file );
 
@@ -839,8 +987,8 @@ static void dvb_class_init ( DvbClass *class )
 
 	g_signal_new ( "dvb-scan-stop", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
 	g_signal_new ( "dvb-scan-done", G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0 );
-	g_signal_new ( "dvb-scan",      G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 16, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, 
-		G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_INT, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING );
+	g_signal_new ( "dvb-scan",      G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 19, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, 
+		G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_INT, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT );
 
 	g_signal_new ( "dvb-fe-msec",  G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_UINT );
 	g_signal_new ( "stats-org",    G_TYPE_FROM_CLASS ( class ), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_INT, G_TYPE_STRING );
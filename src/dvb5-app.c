@@ -9,6 +9,8 @@
 
 #include "dvb5-app.h"
 #include "dvb5-win.h"
+#include "bench.h"
+#include "replay.h"
 
 struct _Dvb5App
 {
@@ -31,9 +33,60 @@ static void dvb5_app_open ( GApplication *app, GFile **files, int n_files, G_GNU
 	gtk_window_present ( GTK_WINDOW ( win ) );
 }
 
-static void dvb5_app_init ( G_GNUC_UNUSED Dvb5App *dvb5_app )
+static int dvb5_app_local_options ( G_GNUC_UNUSED GApplication *app, GVariantDict *options )
 {
-	
+	const char *ts = NULL, *gen = NULL, *streams = NULL, *dir = NULL, *writer = "write";
+
+	g_autofree char *spec = NULL;
+
+	if ( g_variant_dict_lookup ( options, "generate", "&s", &gen ) ) ts = spec = g_strconcat ( REPLAY_GEN, gen, NULL );
+
+	if ( !ts && !g_variant_dict_lookup ( options, "replay", "^&ay", &ts ) ) return -1;
+
+	int loops = 1, clients = 0;
+	gboolean pace = FALSE;
+
+	g_variant_dict_lookup ( options, "streams", "&s",   &streams );
+	g_variant_dict_lookup ( options, "loops",   "i",    &loops );
+	g_variant_dict_lookup ( options, "pace",    "b",    &pace );
+	g_variant_dict_lookup ( options, "out-dir", "^&ay", &dir );
+	g_variant_dict_lookup ( options, "clients", "i",    &clients );
+	g_variant_dict_lookup ( options, "writer",  "&s",   &writer );
+
+	// As enum rec_writer
+	const char *writers[] = { "write", "uring", "splice", "prealloc", "direct" };
+
+	uint8_t w = 0; for ( w = 0; w < G_N_ELEMENTS ( writers ); w++ ) if ( g_str_equal ( writer, writers[w] ) ) break;
+
+	if ( w == G_N_ELEMENTS ( writers ) ) { g_printerr ( "Unknown writer: %s \n", writer ); return 1; }
+
+	if ( g_variant_dict_contains ( options, "psi" ) ) return bench_psi ( ts, (uint32_t)MAX ( loops, 1 ) );
+
+	if ( g_variant_dict_contains ( options, "bench-ts" ) ) return bench_ts ( ts, (uint32_t)MAX ( loops, 1 ) );
+
+	return bench_replay ( ts, streams, (uint32_t)MAX ( loops, 1 ), pace, dir, (uint32_t)MAX ( clients, 0 ), w );
+}
+
+static void dvb5_app_init ( Dvb5App *dvb5_app )
+{
+	GOptionEntry entries[] =
+	{
+		{ "replay",   0, 0, G_OPTION_ARG_FILENAME, NULL, "Replay a TS file through the capture engine and print the throughput", "FILE" },
+		{ "generate", 0, 0, G_OPTION_ARG_STRING,   NULL, "Replay a synthetic TS, one loop per second: services=N,pids=N,mbit=N,cc=PPM,tei=PPM,null=PCT", "SPEC" },
+		{ "streams",  0, 0, G_OPTION_ARG_STRING,   NULL, "Concurrent recordings per run ( default 1,8,32 )", "N,N,..." },
+		{ "loops",    0, 0, G_OPTION_ARG_INT,      NULL, "Replay the file N times", "N" },
+		{ "pace",     0, 0, G_OPTION_ARG_NONE,     NULL, "Replay in real time, paced by PCR", NULL },
+		{ "out-dir",  0, 0, G_OPTION_ARG_FILENAME, NULL, "Write the recordings to DIR instead of /dev/null; udp://host:port or rtp://host:port sends stream i to port + i", "DIR" },
+		{ "clients",  0, 0, G_OPTION_ARG_INT,      NULL, "Serve every stream to N HTTP clients on the loopback stream server", "N" },
+		{ "writer",   0, 0, G_OPTION_ARG_STRING,   NULL, "Recording writer: write ( default ), uring, splice, prealloc, direct", "NAME" },
+		{ "psi",      0, 0, G_OPTION_ARG_NONE,     NULL, "Parse the PSI sections of the replay in memory and print sections per second", NULL },
+		{ "bench-ts", 0, 0, G_OPTION_ARG_NONE,     NULL, "Parse and route the packets of the replay in memory, scalar and SIMD, and print packets per second", NULL },
+		{ NULL }
+	};
+
+	g_application_add_main_option_entries ( G_APPLICATION ( dvb5_app ), entries );
+
+	g_signal_connect ( dvb5_app, "handle-local-options", G_CALLBACK ( dvb5_app_local_options ), NULL );
 }
 
 static void dvb5_app_finalize ( GObject *object )
@@ -9,10 +9,13 @@
 
 #include "dvb.h"
 #include "level.h"
+#include "player.h"
+#include "rtp.h"
 #include "rec-prw.h"
 #include "dvb5-win.h"
 
 #include <locale.h>
+#include <arpa/inet.h>
 #include <linux/dvb/dmx.h>
 
 #define MAX_STATS 4 // MAX_DTV_STATS
@@ -25,9 +28,11 @@ enum col_tree
 	COL_PRW,
 	COL_CHL,
 	COL_SIZE,
+	COL_ERR,
 	COL_SID,
 	COL_VPID,
 	COL_APID,
+	COL_PIDS, // tooltip
 	NUM_COLS
 };
 
@@ -79,6 +84,19 @@ const DvbLnb dvb_lnb_type_n[] =
 	{ "GVBRS", "GVT-BRASILSAT", "Vertical: 11010 to 11067 MHz, LO: 12860 MHz\nVertical: 11704 to 11941 MHz, LO: 13435 MHz\nHorizontal: 10962 to 11199 MHz, LO: 13112 MHz\nHorizontal: 11704 to 12188 MHz, LO: 13138 MHz" }
 };
 
+typedef struct _ZapCapture ZapCapture;
+
+// A running rec / prw of the channel list, or the dvr rec ( row NULL )
+struct _ZapCapture
+{
+	Monitor *monitor;
+	GtkTreeRowReference *row;
+	uint8_t column;
+
+	MonitorStats last;
+	gboolean shown;
+};
+
 struct _Dvb5Win
 {
 	GtkWindow  parent_instance;
@@ -103,15 +121,25 @@ struct _Dvb5Win
 	GtkLabel *freq_scan;
 	GtkLabel *org_status[MAX_STATS];
 
-	Monitor *monitor_dvr;
+	char *dvr_play; // dvr device of the player
+
+	GSList *captures; // ZapCapture
+	guint capture_tick;
 	gboolean stop_dvr_rec;
 
 	Dvb *dvb;
 	gboolean fe_lock;
 
+	uint8_t  writer;
+	uint8_t  prw_drop;
+	uint16_t ring_size;
+	uint16_t stream_port; // 0: previews through a FIFO
+	uint8_t  net_ttl;
+	uint8_t  net_pace;
+
 	int8_t  sat_num; // lna, lnb;
 	uint8_t new_freqs, get_detect, get_nit, other_nit;
-	uint8_t adapter, frontend, demux, time_mult, diseqc_wait;
+	uint8_t adapter, frontend, demux, time_mult, diseqc_wait, tuners, scan_cache, scan_adapt;
 };
 
 G_DEFINE_TYPE ( Dvb5Win, dvb5_win, GTK_TYPE_WINDOW )
@@ -203,7 +231,11 @@ static void scan_signal_spin ( GtkSpinButton *spin, Dvb5Win *win )
 	if ( g_str_has_prefix ( name, "Frontend" ) ) win->frontend    = (uint8_t)val;
 	if ( g_str_has_prefix ( name, "Demux"    ) ) win->demux       = (uint8_t)val;
 	if ( g_str_has_prefix ( name, "Timeout"  ) ) win->time_mult   = (uint8_t)val;
+	if ( g_str_has_prefix ( name, "Tuners"   ) ) win->tuners      = (uint8_t)val;
 	if ( g_str_has_prefix ( name, "Wait"     ) ) win->diseqc_wait = (uint8_t)val;
+	if ( g_str_has_prefix ( name, "Ring"     ) ) win->ring_size   = (uint16_t)val;
+	if ( g_str_has_prefix ( name, "Stream"   ) ) win->stream_port = (uint16_t)val;
+	if ( g_str_has_prefix ( name, "TTL"      ) ) win->net_ttl     = (uint8_t)val;
 
 	if ( g_str_has_prefix ( name, "Adapter" ) || g_str_has_prefix ( name, "Frontend" ) ) g_signal_emit_by_name ( win->dvb, "dvb-info", win->adapter, win->frontend );
 
@@ -219,6 +251,8 @@ static void scan_signal_toggled ( GtkToggleButton *toggled, Dvb5Win *win )
 	if ( g_str_has_prefix ( name, "Get frontend" ) ) win->get_detect = ( val ) ? 1 : 0;
 	if ( g_str_has_prefix ( name, "Nit"          ) ) win->get_nit    = ( val ) ? 1 : 0;
 	if ( g_str_has_prefix ( name, "Other nit"    ) ) win->other_nit  = ( val ) ? 1 : 0;
+	if ( g_str_has_prefix ( name, "Cache"        ) ) win->scan_cache = ( val ) ? 1 : 0;
+	if ( g_str_has_prefix ( name, "Adaptive"     ) ) win->scan_adapt = ( val ) ? 1 : 0;
 
 	g_debug ( "%s: %s = %d ", __func__, name, val );
 }
@@ -233,7 +267,7 @@ static GtkLabel * scan_create_label ( const char *text )
 	return label;
 }
 
-static GtkWidget * scan_create_spin ( int16_t min, int16_t max, uint8_t step, int16_t value, const char *name, Dvb5Win *win )
+static GtkWidget * scan_create_spin ( int min, int max, uint8_t step, int value, const char *name, Dvb5Win *win )
 {
 	GtkSpinButton *spinbutton = (GtkSpinButton *)gtk_spin_button_new_with_range ( min, max, step );
 
@@ -441,7 +475,9 @@ static GtkWidget * scan_create ( Dvb5Win *win )
 		{ scan_create_label ( "Freqs-only" ), scan_create_check ( FALSE, "Freqs-only",    win ), scan_create_label ( "Get frontend" ), scan_create_check ( FALSE, "Get frontend",   win ) },
 		{ scan_create_label ( "Nit"        ), scan_create_check ( FALSE, "Nit",           win ), scan_create_label ( "Other nit"    ), scan_create_check ( FALSE, "Other nit",      win ) },
 		{ scan_create_label ( "LNB"        ), scan_create_combo_lnb ( "LNB",              win ), scan_create_label ( "DISEqC"       ), scan_create_spin  ( -1, 50, 1, -1, "DISEqC",      win ) },
-		{ scan_create_label ( "LNA"        ), scan_create_combo_lna ( "LNA",              win ), scan_create_label ( "Wait DISEqC"  ), scan_create_spin  (  0, 50, 1,  0, "Wait DISEqC", win ) }
+		{ scan_create_label ( "LNA"        ), scan_create_combo_lna ( "LNA",              win ), scan_create_label ( "Wait DISEqC"  ), scan_create_spin  (  0, 50, 1,  0, "Wait DISEqC", win ) },
+		{ scan_create_label ( "Tuners"     ), scan_create_spin  ( 1, 16, 1, 1, "Tuners",  win ), scan_create_label ( "Cache"        ), scan_create_check ( FALSE, "Cache",          win ) },
+		{ scan_create_label ( "Adaptive"   ), scan_create_check ( FALSE, "Adaptive",      win ), scan_create_label ( ""             ), NULL }
 	};
 
 	uint8_t d = 0; for ( d = 0; d < G_N_ELEMENTS ( data_n ); d++ )
@@ -449,7 +485,8 @@ static GtkWidget * scan_create ( Dvb5Win *win )
 		gtk_grid_attach ( grid, GTK_WIDGET ( data_n[d].label_a  ), 0, d, 1, 1 );
 		gtk_grid_attach ( grid, GTK_WIDGET ( data_n[d].widget_a ), 1, d, 1, 1 );
 		gtk_grid_attach ( grid, GTK_WIDGET ( data_n[d].label_b  ), 2, d, 1, 1 );
-		gtk_grid_attach ( grid, GTK_WIDGET ( data_n[d].widget_b ), 3, d, 1, 1 );
+
+		if ( data_n[d].widget_b ) gtk_grid_attach ( grid, GTK_WIDGET ( data_n[d].widget_b ), 3, d, 1, 1 );
 	}
 
 	gtk_grid_attach ( grid, GTK_WIDGET ( scan_create_in_out_entry ( "Initial file",     "Open", win ) ), 0, d, 2, 1 );
@@ -554,7 +591,7 @@ static void zap_treeview_stop_dmx_rec_all_toggled ( Dvb5Win *win )
 	{
 		gtk_tree_model_get ( model, &iter, COL_PRW, &active, -1 );
 
-		gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE,   "", -1 );
+		gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE,   "", COL_ERR, "", COL_PIDS, NULL, -1 );
 		gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_REC, FALSE, -1 );
 		gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_PRW, FALSE, -1 );
 	}
@@ -607,45 +644,228 @@ static char * zap_rec_get_path ( const char *dir, const char *name, Dvb5Win *win
 	return file;
 }
 
-static gboolean zap_monitor ( Monitor *monitor )
+// udp://239.1.1.1:5000 : channel n to 239.1.1.n:5000, a group per channel; a host name is shared
+static char * zap_rec_get_uri ( const char *uri, uint num )
 {
-	if ( !GTK_IS_TREE_VIEW ( monitor->treeview ) ) { monitor->active = 0; return FALSE; }
+	char host[64] = "";
+	uint port = 0;
+	struct in_addr addr;
 
-	char str_path[10];
-	sprintf ( str_path, "%u", monitor->path );
+	if ( sscanf ( uri + strlen ( "udp://" ), "%63[^:]:%u", host, &port ) != 2 || inet_pton ( AF_INET, host, &addr ) != 1 ) return g_strdup ( uri );
 
-	GtkTreeIter iter;
-	GtkTreeModel *model = gtk_tree_view_get_model ( monitor->treeview );
-	GtkTreePath  *path  = gtk_tree_path_new_from_string ( str_path );
+	addr.s_addr = htonl ( ntohl ( addr.s_addr ) + num - 1 );
+
+	char str[INET_ADDRSTRLEN];
+	inet_ntop ( AF_INET, &addr, str, sizeof ( str ) );
+
+	return g_strdup_printf ( "%.6s%s:%u", uri, str, port );
+}
+
+static char * zap_monitor_errors ( const MonitorStats *st )
+{
+	return g_strdup_printf ( "CC %" G_GUINT64_FORMAT " / TEI %" G_GUINT64_FORMAT " / Scr %" G_GUINT64_FORMAT " / Ovf %" G_GUINT64_FORMAT " / Drop %" G_GUINT64_FORMAT " KB / PCR %" G_GUINT64_FORMAT,
+		st->cc_error, st->tei_error, st->scrambled, st->dmx_overflow, ( st->ring_drop + st->fifo_drop ) / 1024, st->pcr_disc );
+}
+
+// PCR timed when the stream has a PCR
+static uint32_t zap_monitor_bitrate ( const MonitorStats *st )
+{
+	return ( st->pcr_bitrate ) ? st->pcr_bitrate : st->bitrate;
+}
+
+static char * zap_monitor_pids ( Monitor *monitor )
+{
+	MonitorPids pids;
+	monitor_pids ( monitor, &pids );
+
+	GString *str = g_string_new ( NULL );
+
+	uint32_t i = 0; for ( i = 0; i < pids.n_pid; i++ )
+		g_string_append_printf ( str, "%sPID %4u  %6u Kbps  CC %u", ( i ) ? "\n" : "", pids.pid[i].pid, pids.pid[i].bitrate, pids.pid[i].cc_error );
+
+	for ( i = 0; i < pids.n_clock; i++ )
+		g_string_append_printf ( str, "\nPCR %4u  interval %u us  jitter %u ns  disc %u", pids.clock[i].pid, pids.clock[i].interval, pids.clock[i].jitter, pids.clock[i].disc );
+
+	return g_string_free ( str, FALSE );
+}
+
+// Fields shown in the list: anything else changing does not redraw the row
+static gboolean zap_capture_changed ( const MonitorStats *a, const MonitorStats *b )
+{
+	return a->bitrate != b->bitrate || a->pcr_bitrate != b->pcr_bitrate || a->pcr_interval != b->pcr_interval || a->pcr_jitter != b->pcr_jitter
+		|| a->pcr_disc != b->pcr_disc || a->size_file != b->size_file || a->ring_hwm != b->ring_hwm || a->dmx_size != b->dmx_size
+		|| a->lat_p50 != b->lat_p50 || a->lat_p99 != b->lat_p99 || a->cc_error != b->cc_error || a->tei_error != b->tei_error
+		|| a->scrambled != b->scrambled || a->dmx_overflow != b->dmx_overflow || a->ring_drop != b->ring_drop || a->fifo_drop != b->fifo_drop
+		|| a->clients != b->clients;
+}
+
+static void zap_capture_free ( ZapCapture *cap )
+{
+	dmx_rec_prw_stop ( cap->monitor );
+	monitor_unref ( cap->monitor );
+
+	if ( cap->row ) gtk_tree_row_reference_free ( cap->row );
+
+	free ( cap );
+}
+
+// FALSE once the row is gone ( list cleared ) or unchecked
+static gboolean zap_capture_iter ( ZapCapture *cap, GtkTreeIter *iter )
+{
+	GtkTreePath *path = gtk_tree_row_reference_get_path ( cap->row );
+
+	if ( !path ) return FALSE;
+
+	gboolean active = FALSE;
+	GtkTreeModel *model = gtk_tree_row_reference_get_model ( cap->row );
+
+	if ( gtk_tree_model_get_iter ( model, iter, path ) ) gtk_tree_model_get ( model, iter, cap->column, &active, -1 );
 
-	gtk_tree_model_get_iter ( model, &iter, path );
 	gtk_tree_path_free ( path );
 
-	gboolean active;
-	gtk_tree_model_get ( model, &iter, monitor->column, &active, -1 );
+	return active;
+}
+
+static void zap_capture_show ( ZapCapture *cap, GtkTreeIter *iter, Dvb5Win *win )
+{
+	MonitorStats st;
+	monitor_stats ( cap->monitor, &st );
+
+	if ( cap->shown && !zap_capture_changed ( &st, &cap->last ) ) return;
+
+	cap->last = st;
+	cap->shown = TRUE;
 
-	if ( !active ) { monitor->active = 0; gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE, " ", -1 ); return FALSE; }
+	g_autofree char *str_size = g_format_size ( st.size_file );
+	g_autofree char *err = zap_monitor_errors ( &st );
 
-	if ( active )
+	if ( !cap->row )
 	{
-		g_autofree char *str_size = g_format_size ( monitor->size_file );
-		g_autofree char *str = g_strdup_printf ( "%u Kbps / %s", monitor->bitrate, str_size );
+		g_autofree char *str = g_strdup_printf ( "%u Kbps / %s / Ring %u%% / Dvr %u KB / Write %u - %u us / %s", zap_monitor_bitrate ( &st ), str_size, st.ring_hwm, st.dmx_size, st.lat_p50, st.lat_p99, err );
+
+		gtk_label_set_text ( win->dvr_rec, str );
 
-		gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE, str, -1 );
+		return;
 	}
 
-	return TRUE;
+	g_autofree char *str = ( cap->column == COL_PRW && cap->monitor->stream_port )
+		? g_strdup_printf ( "%u Kbps / %s / Ring %u%% / Dmx %u KB / Clients %u", zap_monitor_bitrate ( &st ), str_size, st.ring_hwm, st.dmx_size, st.clients )
+		: g_strdup_printf ( "%u Kbps / %s / Ring %u%% / Dmx %u KB / Write %u - %u us", zap_monitor_bitrate ( &st ), str_size, st.ring_hwm, st.dmx_size, st.lat_p50, st.lat_p99 );
+
+	g_autofree char *pids = zap_monitor_pids ( cap->monitor );
+
+	gtk_list_store_set ( GTK_LIST_STORE ( gtk_tree_row_reference_get_model ( cap->row ) ), iter, COL_SIZE, str, COL_ERR, err, COL_PIDS, pids, -1 );
+}
+
+// Stops the captures whose row is gone or unchecked ( dvr: stop_dvr_rec ); refresh: shows the others
+static void zap_capture_sync ( gboolean refresh, Dvb5Win *win )
+{
+	GSList *l = win->captures; while ( l )
+	{
+		GSList *next = l->next;
+		ZapCapture *cap = (ZapCapture *)l->data;
+
+		GtkTreeIter iter;
+		gboolean run = ( cap->row ) ? zap_capture_iter ( cap, &iter ) : !win->stop_dvr_rec;
+
+		if ( !run )
+		{
+			if ( !cap->row ) gtk_label_set_text ( win->dvr_rec, "" );
+
+			zap_capture_free ( cap );
+			win->captures = g_slist_delete_link ( win->captures, l );
+		}
+		else if ( refresh )
+			zap_capture_show ( cap, &iter, win );
+
+		l = next;
+	}
+}
+
+static gboolean zap_capture_tick ( Dvb5Win *win )
+{
+	zap_capture_sync ( TRUE, win );
+
+	if ( win->captures ) return TRUE;
+
+	win->capture_tick = 0;
+
+	return FALSE;
+}
+
+// One timer for every capture; the rows are set in one batch and GTK redraws them in one frame
+static void zap_capture_add ( Monitor *monitor, enum col_tree column, GtkTreePath *path, Dvb5Win *win )
+{
+	ZapCapture *cap = g_new0 ( ZapCapture, 1 );
+
+	cap->monitor = monitor;
+	cap->column  = column;
+	cap->row     = ( path ) ? gtk_tree_row_reference_new ( gtk_tree_view_get_model ( win->treeview ), path ) : NULL;
+
+	win->captures = g_slist_append ( win->captures, cap );
+
+	if ( !win->capture_tick ) win->capture_tick = g_timeout_add_seconds ( 1, (GSourceFunc)zap_capture_tick, win );
+}
+
+// One line per PID and per PCR clock of every running capture
+static void zap_stats_save ( G_GNUC_UNUSED GtkButton *button, Dvb5Win *win )
+{
+	if ( !win->captures ) { dvb5_message_dialog ( "", "No captures", GTK_MESSAGE_INFO, GTK_WINDOW ( win ) ); return; }
+
+	g_autofree char *date = zap_time_to_str ();
+	g_autofree char *name = g_strdup_printf ( "dvb5-stats-%s.csv", date );
+	g_autofree char *file = file_save ( g_get_home_dir (), name, GTK_WINDOW ( win ) );
+
+	if ( !file ) return;
+
+	GString *csv = g_string_new ( "channel,kind,pid,kbps,cc_error,interval_us,jitter_ns,disc\n" );
+
+	GSList *l = NULL; for ( l = win->captures; l; l = l->next )
+	{
+		ZapCapture *cap = (ZapCapture *)l->data;
+
+		GtkTreeIter iter;
+		g_autofree char *channel = NULL;
+
+		if ( cap->row && zap_capture_iter ( cap, &iter ) ) gtk_tree_model_get ( gtk_tree_row_reference_get_model ( cap->row ), &iter, COL_CHL, &channel, -1 );
+
+		const char *chl = ( channel ) ? channel : "Dvr";
+
+		MonitorStats st;
+		monitor_stats ( cap->monitor, &st );
+
+		MonitorPids pids;
+		monitor_pids ( cap->monitor, &pids );
+
+		g_string_append_printf ( csv, "\"%s\",all,,%u,%" G_GUINT64_FORMAT ",%u,%u,%" G_GUINT64_FORMAT "\n", chl, zap_monitor_bitrate ( &st ), st.cc_error, st.pcr_interval, st.pcr_jitter, st.pcr_disc );
+
+		uint32_t i = 0; for ( i = 0; i < pids.n_pid; i++ )
+			g_string_append_printf ( csv, "\"%s\",pid,%u,%u,%u,,,\n", chl, pids.pid[i].pid, pids.pid[i].bitrate, pids.pid[i].cc_error );
+
+		for ( i = 0; i < pids.n_clock; i++ )
+			g_string_append_printf ( csv, "\"%s\",pcr,%u,,,%u,%u,%u\n", chl, pids.clock[i].pid, pids.clock[i].interval, pids.clock[i].jitter, pids.clock[i].disc );
+	}
+
+	GError *error = NULL;
+
+	if ( !g_file_set_contents ( file, csv->str, (gssize)csv->len, &error ) )
+	{
+		dvb5_message_dialog ( "", error->message, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
+		g_error_free ( error );
+	}
+
+	g_string_free ( csv, TRUE );
 }
 
-static Monitor * zap_create_monitor ( enum col_tree col_num, char *path_str, Dvb5Win *win )
+static Monitor * zap_create_monitor ( Dvb5Win *win )
 {
-		Monitor *monitor = g_new0 ( Monitor, 1 );
-		monitor->column = col_num;
-		monitor->active = 1;
-		monitor->bitrate = 0;
-		monitor->size_file = 0;
-		monitor->treeview = win->treeview;
-		monitor->path = (uint16_t)atoi ( path_str );
+	Monitor *monitor = monitor_new ();
+	monitor->writer = win->writer;
+	monitor->prw_drop = win->prw_drop;
+	monitor->ring_size = win->ring_size;
+	monitor->stream_port = win->stream_port;
+	monitor->net_ttl = win->net_ttl;
+	monitor->net_pace = win->net_pace;
 
 	return monitor;
 }
@@ -664,7 +884,7 @@ static void zap_rec_toggled ( G_GNUC_UNUSED GtkCellRendererToggle *toggle, char
 	gtk_tree_model_get ( model, &iter, COL_REC, &toggle_item, -1 );
 
 	toggle_item = !toggle_item;
-	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE, "", -1 );
+	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE, "", COL_ERR, "", COL_PIDS, NULL, -1 );
 	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_REC, toggle_item, -1 );
 
 	g_debug ( "%s: toggle_item %d | path_str %d ",  __func__, toggle_item, atoi ( path_str ) );
@@ -681,8 +901,11 @@ static void zap_rec_toggled ( G_GNUC_UNUSED GtkCellRendererToggle *toggle, char
 
 		uint16_t pids[] = { (uint16_t)sid, (uint16_t)vpid, (uint16_t)apid };
 
+		uint num = 0;
+		gtk_tree_model_get ( model, &iter, COL_NUM, &num, -1 );
+
 		const char *dir = gtk_entry_get_text ( win->entry_rec );
-		g_autofree char *file_rec = zap_rec_get_path ( dir, channel, win );
+		g_autofree char *file_rec = ( rtp_uri ( dir ) ) ? zap_rec_get_uri ( dir, num ) : zap_rec_get_path ( dir, channel, win );
 
 		if ( !file_rec )
 		{
@@ -692,19 +915,22 @@ static void zap_rec_toggled ( G_GNUC_UNUSED GtkCellRendererToggle *toggle, char
 			return;
 		}
 
-		Monitor *monitor = zap_create_monitor ( COL_REC, path_str, win );
+		Monitor *monitor = zap_create_monitor ( win );
+		monitor->sid = (uint16_t)sid;
 
 		const char *res = dmx_rec_create ( win->adapter, win->demux, file_rec, 3, pids, monitor );
 
 		if ( res )
 		{
-			free ( monitor );
+			monitor_unref ( monitor );
 			dvb5_message_dialog ( "", res, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
 			gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_REC, FALSE, -1 );
 		}
 		else
-			g_timeout_add_seconds ( 1, (GSourceFunc)zap_monitor, monitor );
+			zap_capture_add ( monitor, COL_REC, path, win );
 	}
+	else
+		zap_capture_sync ( FALSE, win );
 
 	gtk_tree_path_free ( path );
 }
@@ -727,7 +953,7 @@ static void zap_prw_toggled ( G_GNUC_UNUSED GtkCellRendererToggle *toggle, char
 	gtk_tree_model_get ( model, &iter, COL_PRW, &toggle_item, -1 );
 
 	toggle_item = !toggle_item;
-	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE, "", -1 );
+	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_SIZE, "", COL_ERR, "", COL_PIDS, NULL, -1 );
 	gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_PRW, toggle_item, -1 );
 
 	g_debug ( "%s: toggle_item %d | path_str %s ",  __func__, toggle_item, path_str );
@@ -747,21 +973,30 @@ static void zap_prw_toggled ( G_GNUC_UNUSED GtkCellRendererToggle *toggle, char
 		g_autofree char *date = zap_time_to_str ();
 
 		char file_new[PATH_MAX];
-		sprintf ( file_new, "/tmp/%s", date );
 
-		Monitor *monitor = zap_create_monitor ( COL_PRW, path_str, win );
+		// Stream: http://127.0.0.1:port/adapter/sid, for the player and any other client
+		if ( win->stream_port )
+			sprintf ( file_new, "/%u/%u", win->adapter, sid );
+		else
+			sprintf ( file_new, "/tmp/%s", date );
+
+		Monitor *monitor = zap_create_monitor ( win );
 
-		const char *res = dmx_prw_create ( win->adapter, win->demux, file_new, 3, pids, monitor, player );
+		const char *res = ( win->stream_port )
+			? dmx_stream_create ( win->adapter, win->demux, file_new, 3, pids, monitor, player )
+			: dmx_prw_create ( win->adapter, win->demux, file_new, 3, pids, monitor, player );
 
 		if ( res )
 		{
-			free ( monitor );
+			monitor_unref ( monitor );
 			dvb5_message_dialog ( "", res, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
 			gtk_list_store_set ( GTK_LIST_STORE ( model ), &iter, COL_PRW, FALSE, -1 );
 		}
 		else
-			g_timeout_add_seconds ( 1, (GSourceFunc)zap_monitor, monitor );
+			zap_capture_add ( monitor, COL_PRW, path, win );
 	}
+	else
+		zap_capture_sync ( FALSE, win );
 
 	gtk_tree_path_free ( path );
 }
@@ -772,9 +1007,10 @@ static GtkScrolledWindow * zap_create_tree ( Dvb5Win *win )
 	gtk_scrolled_window_set_policy ( scroll, GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
 	gtk_widget_set_visible ( GTK_WIDGET ( scroll ), TRUE );
 
-	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING );
+	GtkListStore *store = gtk_list_store_new ( NUM_COLS, G_TYPE_UINT, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_STRING );
 
 	win->treeview = (GtkTreeView *)gtk_tree_view_new_with_model ( GTK_TREE_MODEL ( store ) );
+	gtk_tree_view_set_tooltip_column ( win->treeview, COL_PIDS );
 	gtk_widget_set_visible ( GTK_WIDGET ( win->treeview ), TRUE );
 
 	gtk_drag_dest_set ( GTK_WIDGET ( win->treeview ), GTK_DEST_DEFAULT_ALL, NULL, 0, GDK_ACTION_COPY );
@@ -790,6 +1026,7 @@ static GtkScrolledWindow * zap_create_tree ( Dvb5Win *win )
 		{ "Prw",        	"active", COL_PRW  },
 		{ "Channel",    	"text",   COL_CHL  },
 		{ "Bitrate / Size", "text",   COL_SIZE },
+		{ "Errors",     	"text",   COL_ERR  },
 		{ "SID",      		"text",   COL_SID  },
 		{ "Video",      	"text",   COL_VPID },
 		{ "Audio",      	"text",   COL_APID }
@@ -823,41 +1060,6 @@ static GtkScrolledWindow * zap_create_tree ( Dvb5Win *win )
 	return scroll;
 }
 
-static void zap_dvr_play_stop ( void )
-{
-	int pid = 0, SIZE = 1024;
-
-	char line[SIZE];
-
-	FILE *fp = popen ( "ps -T -f -o pid:1,args", "r" );
-
-	while ( !feof (fp) )
-	{
-		if ( fgets ( line, SIZE, fp ) )
-		{
-			if ( g_strrstr ( line, "dvr" ) ) pid = (int)strtoul ( line, NULL, 10 );
-		}
-	}
-
-	pclose ( fp );
-
-	if ( pid ) kill ( pid, SIGINT );
-}
-
-static gboolean zap_monitor_dvr_rec ( Dvb5Win *win )
-{
-	if ( !GTK_IS_TREE_VIEW ( win->treeview ) ) return FALSE;
-
-	if ( win->stop_dvr_rec ) { gtk_label_set_text ( win->dvr_rec, "" ); win->monitor_dvr->active = 0; return FALSE; }
-
-	g_autofree char *str_size = g_format_size ( win->monitor_dvr->size_file );
-	g_autofree char *str = g_strdup_printf ( "%u Kbps / %s", win->monitor_dvr->bitrate, str_size );
-
-	gtk_label_set_text ( win->dvr_rec, str );
-
-	return TRUE;
-}
-
 static void zap_dvr_play ( G_GNUC_UNUSED GtkButton *button, Dvb5Win *win )
 {
 	if ( !win->fe_lock ) { dvb5_message_dialog ( "", "Zap?", GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) ); return; }
@@ -871,13 +1073,9 @@ static void zap_dvr_play ( G_GNUC_UNUSED GtkButton *button, Dvb5Win *win )
 
 	if ( !zap_check_player ( player ) ) { dvb5_message_dialog ( player, g_strerror ( errno ), GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) ); return; }
 
-	char dvr_play[PATH_MAX];
-	sprintf ( dvr_play, "%s /dev/dvb/adapter%d/dvr0", player, win->adapter );
-
-	GAppInfo *app = g_app_info_create_from_commandline ( dvr_play, NULL, G_APP_INFO_CREATE_NONE, NULL );
-
 	GError *error = NULL;
-	g_app_info_launch ( app, NULL, NULL, &error );
+
+	if ( player_start ( player, dvrdev, &error ) ) { free ( win->dvr_play ); win->dvr_play = g_strdup ( dvrdev ); }
 
 	if ( error ) { dvb5_message_dialog ( "", error->message, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) ); g_warning ( "%s: %s", __func__, error->message ); g_error_free ( error ); }
 }
@@ -902,25 +1100,23 @@ static void zap_dvr_rec ( G_GNUC_UNUSED GtkButton *button, Dvb5Win *win )
 	}
 
 	const char *dir = gtk_entry_get_text ( win->entry_rec );
-	g_autofree char *file_rec = zap_rec_get_path ( dir, ( channel ) ? channel : "Record", win );
+	g_autofree char *file_rec = ( rtp_uri ( dir ) ) ? g_strdup ( dir ) : zap_rec_get_path ( dir, ( channel ) ? channel : "Record", win );
 
 	if ( !file_rec ) return;
 
-	Monitor *monitor = zap_create_monitor ( COL_NUM, "0", win );
+	Monitor *monitor = zap_create_monitor ( win );
 
 	win->stop_dvr_rec = FALSE;
-	win->monitor_dvr = monitor;
 
 	const char *res = dvr_rec_create ( dvrdev, file_rec, monitor );
 
 	if ( res )
 	{
-		free ( monitor );
-		win->monitor_dvr = NULL;
+		monitor_unref ( monitor );
 		dvb5_message_dialog ( "", res, GTK_MESSAGE_WARNING, GTK_WINDOW ( win ) );
 	}
 	else
-		g_timeout_add_seconds ( 1, (GSourceFunc)zap_monitor_dvr_rec, win );
+		zap_capture_add ( monitor, COL_NUM, NULL, win );
 }
 
 static void zap_popover_hide ( G_GNUC_UNUSED GtkButton *button, GtkPopover *popover )
@@ -941,6 +1137,31 @@ static GtkButton * zap_create_button ( const char *text, GtkPopover *popover, fp
 	return button;
 }
 
+static void zap_signal_combo ( GtkComboBox *combo_box, Dvb5Win *win )
+{
+	int num = gtk_combo_box_get_active ( combo_box );
+	const char *name = gtk_widget_get_name ( GTK_WIDGET ( combo_box ) );
+
+	if ( g_str_has_prefix ( name, "Writer" ) ) win->writer = (uint8_t)num;
+	if ( g_str_has_prefix ( name, "Drop"   ) ) win->prw_drop = (uint8_t)num;
+	if ( g_str_has_prefix ( name, "Pace"   ) ) win->net_pace = (uint8_t)num;
+
+	g_debug ( "%s: %s = %d ", __func__, name, num );
+}
+
+static GtkWidget * zap_create_combo ( const char *text[], uint8_t indx, int8_t active, const char *name, Dvb5Win *win )
+{
+	GtkComboBoxText *combo = (GtkComboBoxText *) gtk_combo_box_text_new ();
+	gtk_widget_set_name ( GTK_WIDGET ( combo ), name );
+	scan_append_text_combo_box ( combo, text, indx, active );
+
+	g_signal_connect ( combo, "changed", G_CALLBACK ( zap_signal_combo ), win );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( combo ), TRUE );
+
+	return GTK_WIDGET ( combo );
+}
+
 static GtkBox * zap_create_box_popover ( GtkPopover *popover, Dvb5Win *win )
 {
 	GtkBox *v_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_VERTICAL, 0 );
@@ -954,6 +1175,7 @@ static GtkBox * zap_create_box_popover ( GtkPopover *popover, Dvb5Win *win )
 
 	GtkButton *button_play = zap_create_button ( "dvb-start", popover, zap_dvr_play, win );
 	GtkButton *button_rec  = zap_create_button ( "dvb-rec",   popover, zap_dvr_rec,  win );
+	GtkButton *button_save = zap_create_button ( "document-save", popover, zap_stats_save, win );
 
 	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
 
@@ -973,6 +1195,67 @@ static GtkBox * zap_create_box_popover ( GtkPopover *popover, Dvb5Win *win )
 
 	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
 
+	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
+	gtk_box_set_spacing ( h_box, 5 );
+
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( button_save ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( scan_create_label ( "Captures: Save PID stats, CSV" ) ), TRUE, TRUE, 0 );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
+	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
+
+	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
+	gtk_box_set_spacing ( h_box, 5 );
+
+	gtk_box_pack_start ( h_box, scan_create_spin ( 1, 1024, 1, (int16_t)win->ring_size, "Ring", win ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( scan_create_label ( "Ring buffer, MB" ) ), TRUE, TRUE, 0 );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
+	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
+
+	const char *writers[] = { "write", "io_uring", "splice", "prealloc", "O_DIRECT" };
+
+	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
+	gtk_box_set_spacing ( h_box, 5 );
+
+	gtk_box_pack_start ( h_box, zap_create_combo ( writers, G_N_ELEMENTS ( writers ), (int8_t)win->writer, "Writer", win ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( scan_create_label ( "Rec writer" ) ), TRUE, TRUE, 0 );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
+	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
+
+	const char *drops[] = { "oldest", "newest" };
+
+	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
+	gtk_box_set_spacing ( h_box, 5 );
+
+	gtk_box_pack_start ( h_box, zap_create_combo ( drops, G_N_ELEMENTS ( drops ), (int8_t)win->prw_drop, "Drop", win ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( scan_create_label ( "Preview drop, slow player" ) ), TRUE, TRUE, 0 );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
+	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
+
+	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
+	gtk_box_set_spacing ( h_box, 5 );
+
+	gtk_box_pack_start ( h_box, scan_create_spin ( 0, 65535, 1, win->stream_port, "Stream", win ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( scan_create_label ( "Preview server port, 0: FIFO" ) ), TRUE, TRUE, 0 );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
+	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
+
+	const char *paces[] = { "burst", "paced" };
+
+	h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
+	gtk_box_set_spacing ( h_box, 5 );
+
+	gtk_box_pack_start ( h_box, scan_create_spin ( 1, 255, 1, (int16_t)win->net_ttl, "TTL", win ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, zap_create_combo ( paces, G_N_ELEMENTS ( paces ), (int8_t)win->net_pace, "Pace", win ), FALSE, FALSE, 0 );
+	gtk_box_pack_start ( h_box, GTK_WIDGET ( scan_create_label ( "Rec to udp:// rtp://" ) ), TRUE, TRUE, 0 );
+
+	gtk_widget_set_visible ( GTK_WIDGET ( h_box ), TRUE );
+	gtk_box_pack_start ( v_box, GTK_WIDGET ( h_box ), FALSE, FALSE, 0 );
+
 	return v_box;
 }
 
@@ -1066,7 +1349,8 @@ static GtkWidget * zap_grid ( Dvb5Win *win )
 	gtk_grid_set_column_homogeneous ( grid, TRUE  );
 
 	win->entry_play = zap_create_entry ( "ffplay", NULL, TRUE, win );
-	win->entry_rec  = zap_create_entry ( g_get_home_dir (), "Record folder", FALSE, win );
+	win->entry_rec  = zap_create_entry ( g_get_home_dir (), "Record folder, or udp://group:port rtp://group:port", FALSE, win );
+	g_object_set ( win->entry_rec, "editable", TRUE, NULL );
 	win->entry_file = zap_create_entry ( "dvb_channel.conf", "Format only DVBV5", FALSE, win );
 
 	GtkBox *h_box = (GtkBox *)gtk_box_new ( GTK_ORIENTATION_HORIZONTAL, 0 );
@@ -1147,7 +1431,7 @@ static void status_clicked_scan ( G_GNUC_UNUSED GtkButton *button, Dvb5Win *win
 	g_debug ( "%s: %s, %s ", __func__, file_int, file_out );
 
 	g_signal_emit_by_name ( win->dvb, "dvb-scan", win->adapter, win->frontend, win->demux, win->time_mult, win->new_freqs, win->get_detect, win->get_nit, win->other_nit, 
-		win->sat_num, win->diseqc_wait, lnb, lna, file_int, file_out, fm_int, fm_out );
+		win->sat_num, win->diseqc_wait, lnb, lna, file_int, file_out, fm_int, fm_out, win->tuners, win->scan_cache, win->scan_adapt );
 }
 
 static gboolean zap_timeout_stop ( Dvb5Win *win )
@@ -1161,11 +1445,12 @@ static gboolean zap_timeout_stop ( Dvb5Win *win )
 
 static void status_clicked_stop ( G_GNUC_UNUSED GtkButton *button, Dvb5Win *win )
 {
-	zap_dvr_play_stop ();
+	if ( win->dvr_play ) player_stop ( win->dvr_play );
 
 	win->stop_dvr_rec = TRUE;
 
 	zap_treeview_stop_dmx_rec_all_toggled ( win );
+	zap_capture_sync ( FALSE, win );
 
 	g_signal_emit_by_name ( win->dvb, "dvb-scan-stop" );
 
@@ -1428,6 +1713,9 @@ static void dvb5_win_init ( Dvb5Win *win )
 	win->frontend  = 0;
 	win->demux     = 0;
 	win->time_mult = 2;
+	win->tuners    = 1;
+	win->scan_cache = 0;
+	win->scan_adapt = 0;
 
 	win->new_freqs  = 0;
 	win->get_detect = 0;
@@ -1439,9 +1727,17 @@ static void dvb5_win_init ( Dvb5Win *win )
 	win->sat_num = -1;
 	win->diseqc_wait = 0;
 
-	win->monitor_dvr = NULL;
+	win->dvr_play = NULL;
+	win->captures = NULL;
+	win->capture_tick = 0;
 	win->stop_dvr_rec = FALSE;
 
+	win->writer = REC_WRITER_WRITE;
+	win->prw_drop = PRW_DROP_OLDEST;
+	win->ring_size = 16;
+	win->net_ttl = 1;
+	win->net_pace = FALSE;
+
 	win->dvb = dvb_new ();
 
 	g_signal_connect ( win->dvb, "dvb-name",      G_CALLBACK ( dvb5_handler_dvb_name  ), win );
@@ -1460,6 +1756,13 @@ static void dvb5_win_finalize ( GObject *object )
 {
 	Dvb5Win *win = DVB5_WIN ( object );
 
+	g_slist_free_full ( win->captures, (GDestroyNotify)zap_capture_free );
+	win->captures = NULL;
+
+	if ( win->capture_tick ) g_source_remove ( win->capture_tick );
+
+	free ( win->dvr_play );
+
 	g_object_unref ( win->dvb );
 
 	G_OBJECT_CLASS ( dvb5_win_parent_class )->finalize ( object );
@@ -0,0 +1,85 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "player.h"
+
+#include <signal.h>
+
+static GMutex players_lock;
+static GHashTable *players = NULL; // file -> GSubprocess
+
+static void player_exited ( GSubprocess *sp, GAsyncResult *res, char *file )
+{
+	GError *error = NULL;
+
+	if ( !g_subprocess_wait_finish ( sp, res, &error ) )
+	{
+		g_warning ( "%s:: %s: %s", __func__, file, error->message );
+		g_error_free ( error );
+	}
+	else if ( g_subprocess_get_if_signaled ( sp ) )
+		g_debug ( "%s:: %s: signal %d", __func__, file, g_subprocess_get_term_sig ( sp ) );
+	else
+		g_debug ( "%s:: %s: exit status %d", __func__, file, g_subprocess_get_exit_status ( sp ) );
+
+	g_mutex_lock ( &players_lock );
+
+	// A new player may play the same file by now
+	if ( g_hash_table_lookup ( players, file ) == sp ) g_hash_table_remove ( players, file );
+
+	g_mutex_unlock ( &players_lock );
+
+	free ( file );
+}
+
+gboolean player_start ( const char *player, const char *file, GError **error )
+{
+	int argc = 0;
+	char **argv = NULL;
+
+	if ( !g_shell_parse_argv ( player, &argc, &argv, error ) ) return FALSE;
+
+	argv = g_renew ( char *, argv, argc + 2 );
+	argv[argc] = g_strdup ( file );
+	argv[argc + 1] = NULL;
+
+	GSubprocess *sp = g_subprocess_newv ( (const char * const *)argv, G_SUBPROCESS_FLAGS_NONE, error );
+
+	g_strfreev ( argv );
+
+	if ( !sp ) return FALSE;
+
+	g_mutex_lock ( &players_lock );
+
+	if ( !players ) players = g_hash_table_new_full ( g_str_hash, g_str_equal, g_free, g_object_unref );
+
+	GSubprocess *old = g_hash_table_lookup ( players, file );
+
+	if ( old ) g_subprocess_send_signal ( old, SIGINT );
+
+	g_hash_table_replace ( players, g_strdup ( file ), sp );
+
+	g_mutex_unlock ( &players_lock );
+
+	// Reaped in the main loop, the exit status is logged
+	g_subprocess_wait_async ( sp, NULL, (GAsyncReadyCallback)player_exited, g_strdup ( file ) );
+
+	return TRUE;
+}
+
+void player_stop ( const char *file )
+{
+	g_mutex_lock ( &players_lock );
+
+	GSubprocess *sp = ( players ) ? g_hash_table_lookup ( players, file ) : NULL;
+
+	if ( sp ) g_subprocess_send_signal ( sp, SIGINT );
+
+	g_mutex_unlock ( &players_lock );
+}
@@ -0,0 +1,23 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <gio/gio.h>
+
+/*
+ * Preview players, tracked by the file they play ( FIFO or dvr device ).
+ * Stop is a lookup and a signal: no process scan, no fork.
+ */
+
+// player: command line, file is appended as the last argument
+gboolean player_start ( const char *player, const char *file, GError **error );
+
+// SIGINT to the player of file while it runs; from any thread
+void player_stop ( const char *file );
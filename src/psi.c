@@ -0,0 +1,185 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "ts.h"
+#include "psi.h"
+
+#define CRC_POLY 0x04C11DB7
+
+// crc_table[k][b]: byte b followed by k zero bytes
+static uint32_t crc_table[8][256];
+
+static void psi_crc_init ( void )
+{
+	uint32_t i = 0; for ( i = 0; i < 256; i++ )
+	{
+		uint32_t crc = i << 24;
+
+		uint8_t k = 0; for ( k = 0; k < 8; k++ ) crc = ( crc & 0x80000000 ) ? ( crc << 1 ) ^ CRC_POLY : crc << 1;
+
+		crc_table[0][i] = crc;
+	}
+
+	for ( i = 0; i < 256; i++ )
+	{
+		uint8_t t = 0; for ( t = 1; t < 8; t++ ) crc_table[t][i] = ( crc_table[t - 1][i] << 8 ) ^ crc_table[0][crc_table[t - 1][i] >> 24];
+	}
+}
+
+uint32_t psi_crc32 ( const uint8_t *p, uint32_t len )
+{
+	static gsize init = 0;
+
+	if ( g_once_init_enter ( &init ) ) { psi_crc_init (); g_once_init_leave ( &init, 1 ); }
+
+	uint32_t crc = 0xFFFFFFFF;
+
+	// 8 bytes per step, 8 independent lookups
+	for ( ; len >= 8; len -= 8, p += 8 )
+	{
+		uint32_t a = crc ^ ( ( (uint32_t)p[0] << 24 ) | ( (uint32_t)p[1] << 16 ) | ( (uint32_t)p[2] << 8 ) | p[3] );
+
+		crc = crc_table[7][a >> 24] ^ crc_table[6][( a >> 16 ) & 0xFF] ^ crc_table[5][( a >> 8 ) & 0xFF] ^ crc_table[4][a & 0xFF]
+			^ crc_table[3][p[4]] ^ crc_table[2][p[5]] ^ crc_table[1][p[6]] ^ crc_table[0][p[7]];
+	}
+
+	while ( len-- ) crc = ( crc << 8 ) ^ crc_table[0][( crc >> 24 ) ^ *p++];
+
+	return crc;
+}
+
+void psi_init ( Psi *psi, uint16_t pid )
+{
+	memset ( psi, 0, sizeof ( Psi ) );
+
+	psi->pid = pid;
+	psi->cc = 0xFF;
+}
+
+void psi_reset ( Psi *psi )
+{
+	psi->n_version = 0;
+	psi->next_version = 0;
+}
+
+static gboolean psi_version_same ( const PsiVersion *a, const PsiVersion *b )
+{
+	return a->table_id == b->table_id && a->section == b->section && a->ext == b->ext && a->ext2 == b->ext2;
+}
+
+static void psi_section ( Psi *psi, PsiFunc func, gpointer data )
+{
+	const uint8_t *sec = psi->sec;
+	uint32_t len = psi->len;
+
+	// Short sections ( TDT, TOT ) have no version
+	if ( !( sec[1] & 0x80 ) ) { psi->n_section++; func ( psi->pid, sec, len, data ); return; }
+
+	// Header, CRC; current_next_indicator 0: not valid yet
+	if ( len < 12 || !( sec[5] & 1 ) ) return;
+
+	gboolean eit = ( sec[0] >= 0x4E && sec[0] <= 0x6F );
+
+	PsiVersion key = { sec[0], sec[6], ( sec[5] >> 1 ) & 0x1F, (uint16_t)( ( sec[3] << 8 ) | sec[4] ), (uint16_t)( ( eit ) ? ( sec[8] << 8 ) | sec[9] : 0 ) };
+
+	PsiVersion *v = NULL;
+
+	uint8_t i = 0; for ( i = 0; i < psi->n_version && !v; i++ ) if ( psi_version_same ( &psi->version[i], &key ) ) v = &psi->version[i];
+
+	if ( v && v->version == key.version ) { psi->n_unchanged++; return; }
+
+	if ( psi_crc32 ( sec, len ) ) { psi->n_crc_error++; return; }
+
+	if ( !v && psi->n_version < PSI_VERSIONS ) v = &psi->version[psi->n_version++];
+
+	if ( !v ) { v = &psi->version[psi->next_version]; psi->next_version = ( psi->next_version + 1 ) % PSI_VERSIONS; }
+
+	*v = key;
+
+	psi->n_section++;
+	func ( psi->pid, sec, len, data );
+}
+
+static inline uint32_t psi_need ( const Psi *psi )
+{
+	return ( psi->len < 3 ) ? 3 : 3 + ( ( ( psi->sec[1] & 0x0F ) << 8 ) | psi->sec[2] );
+}
+
+// Bytes of the section in progress; returns those taken, a complete section is delivered
+static uint32_t psi_fill ( Psi *psi, const uint8_t *p, uint32_t n, PsiFunc func, gpointer data )
+{
+	uint32_t used = 0;
+
+	while ( used < n )
+	{
+		uint32_t need = psi_need ( psi );
+
+		if ( need > PSI_SECTION_MAX ) { psi->len = 0; return n; }
+
+		uint32_t k = MIN ( need - psi->len, n - used );
+
+		memcpy ( psi->sec + psi->len, p + used, k );
+		psi->len = (uint16_t)( psi->len + k );
+		used += k;
+
+		if ( psi->len >= 3 && psi->len == psi_need ( psi ) ) { psi_section ( psi, func, data ); psi->len = 0; break; }
+	}
+
+	return used;
+}
+
+void psi_push ( Psi *psi, const uint8_t *pkt, PsiFunc func, gpointer data )
+{
+	if ( pkt[1] & 0x80 ) { psi->len = 0; psi->cc = 0xFF; return; }
+
+	uint8_t afc = ( pkt[3] >> 4 ) & 3, cc = pkt[3] & 0x0F;
+
+	if ( !( afc & 1 ) ) return;
+
+	// A duplicate packet is skipped, a lost one breaks the section
+	if ( psi->cc != 0xFF && cc == psi->cc ) return;
+
+	if ( psi->cc != 0xFF && cc != ( ( psi->cc + 1 ) & 0x0F ) ) psi->len = 0;
+
+	psi->cc = cc;
+
+	uint32_t off = 4 + ( ( afc & 2 ) ? 1u + pkt[4] : 0 );
+
+	if ( off >= TS_SIZE ) return;
+
+	const uint8_t *p = pkt + off;
+	uint32_t n = TS_SIZE - off;
+
+	if ( !( pkt[1] & 0x40 ) )
+	{
+		if ( psi->len ) psi_fill ( psi, p, n, func, data );
+
+		return;
+	}
+
+	// pointer_field: the end of the last section comes first
+	uint32_t ptr = p[0];
+
+	p++; n--;
+
+	if ( ptr > n ) { psi->len = 0; return; }
+
+	if ( psi->len ) psi_fill ( psi, p, ptr, func, data );
+
+	psi->len = 0;
+	p += ptr; n -= ptr;
+
+	// Sections back to back, up to the stuffing
+	while ( n && p[0] != 0xFF )
+	{
+		uint32_t used = psi_fill ( psi, p, n, func, data );
+
+		p += used; n -= used;
+	}
+}
@@ -0,0 +1,62 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+#define PSI_SECTION_MAX 4096
+#define PSI_VERSIONS    64
+
+/*
+ * Section reassembler of one PID, fed packet by packet; no allocation after psi_init ( ).
+ * A long section whose version was already delivered is skipped before its CRC is checked.
+ */
+
+typedef struct _Psi Psi;
+typedef struct _PsiVersion PsiVersion;
+
+// sec: the whole section with its CRC
+typedef void ( *PsiFunc ) ( uint16_t pid, const uint8_t *sec, uint32_t len, gpointer data );
+
+struct _PsiVersion
+{
+	uint8_t  table_id;
+	uint8_t  section;
+	uint8_t  version;
+	uint16_t ext;  // table_id_extension
+	uint16_t ext2; // EIT: transport_stream_id
+};
+
+struct _Psi
+{
+	uint16_t pid;
+	uint8_t  cc;   // 0xFF: resync
+	uint16_t len;  // bytes in sec, 0: waiting for a section start
+	uint8_t  sec[PSI_SECTION_MAX];
+
+	uint8_t  n_version;
+	uint8_t  next_version; // replaced when the table is full
+	PsiVersion version[PSI_VERSIONS];
+
+	uint64_t n_section;   // delivered
+	uint64_t n_unchanged; // skipped, version known
+	uint64_t n_crc_error;
+};
+
+void psi_init ( Psi *, uint16_t pid );
+
+// Forget the versions: every section is delivered again
+void psi_reset ( Psi * );
+
+// One packet of the PID; func gets every new section
+void psi_push ( Psi *, const uint8_t *pkt, PsiFunc func, gpointer data );
+
+// CRC-32/MPEG-2, slice-by-8; 0 over a whole valid section
+uint32_t psi_crc32 ( const uint8_t *buf, uint32_t len );
@@ -0,0 +1,248 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#define _GNU_SOURCE
+
+#include "rec-file.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define PREALLOC_SIZE ( 64 * 1024 * 1024 )
+#define WB_SIZE       (  8 * 1024 * 1024 )
+#define STAGE_SIZE    (  1 * 1024 * 1024 )
+#define DIRECT_ALIGN  4096
+
+// Log-linear histogram: 8 steps per power of two
+#define LAT_STEPS   8
+#define LAT_BUCKETS ( 40 * LAT_STEPS )
+
+struct _RecFile
+{
+	int fd;
+	uint8_t flags;
+
+	gboolean error;
+
+	uint64_t offset;
+	uint64_t alloc;    // preallocated up to
+	uint64_t wb_start; // write-behind window
+
+	uint8_t *stage;    // O_DIRECT: aligned buffer, always written whole
+	uint32_t stage_len;
+
+	uint64_t lat[LAT_BUCKETS];
+	uint64_t n_lat;
+	uint32_t lat_max;
+};
+
+RecFile * rec_file_new ( int fd, uint8_t flags )
+{
+	RecFile *file = g_new0 ( RecFile, 1 );
+
+	file->fd = fd;
+	file->flags = flags;
+
+	if ( flags & REC_FILE_DIRECT )
+	{
+		void *stage = NULL;
+
+		if ( posix_memalign ( &stage, DIRECT_ALIGN, STAGE_SIZE ) == 0 && fcntl ( fd, F_SETFL, fcntl ( fd, F_GETFL ) | O_DIRECT ) == 0 )
+			file->stage = stage;
+		else
+		{
+			// tmpfs and some fuse file systems refuse O_DIRECT
+			g_message ( "%s:: O_DIRECT is not available, using the page cache.", __func__ );
+
+			free ( stage );
+			file->flags &= (uint8_t)~REC_FILE_DIRECT;
+		}
+	}
+
+	return file;
+}
+
+static uint32_t rec_file_lat_bucket ( uint32_t us )
+{
+	if ( us < LAT_STEPS ) return us;
+
+	uint32_t e = 31 - (uint32_t)__builtin_clz ( us );
+
+	return MIN ( ( e - 2 ) * LAT_STEPS + ( ( us >> ( e - 3 ) ) & ( LAT_STEPS - 1 ) ), LAT_BUCKETS - 1 );
+}
+
+static uint32_t rec_file_lat_value ( uint32_t bucket )
+{
+	if ( bucket < LAT_STEPS ) return bucket;
+
+	uint32_t e = bucket / LAT_STEPS + 2;
+
+	return ( LAT_STEPS + bucket % LAT_STEPS ) << ( e - 3 );
+}
+
+static gboolean rec_file_pwrite ( RecFile *file, const uint8_t *buf, uint32_t len )
+{
+	uint32_t done = 0;
+
+	while ( done < len )
+	{
+		struct timespec t1, t2;
+		clock_gettime ( CLOCK_MONOTONIC, &t1 );
+
+		ssize_t w = write ( file->fd, buf + done, len - done );
+
+		clock_gettime ( CLOCK_MONOTONIC, &t2 );
+
+		if ( w == -1 )
+		{
+			if ( errno == EINTR ) continue;
+
+			file->error = TRUE;
+
+			return FALSE;
+		}
+
+		int64_t us = (int64_t)( t2.tv_sec - t1.tv_sec ) * 1000000 + ( t2.tv_nsec - t1.tv_nsec ) / 1000;
+		uint32_t lat = (uint32_t)CLAMP ( us, 0, G_MAXUINT32 );
+
+		file->lat[rec_file_lat_bucket ( lat )]++;
+		file->lat_max = MAX ( file->lat_max, lat );
+		file->n_lat++;
+
+		done += (uint32_t)w;
+	}
+
+	return TRUE;
+}
+
+static void rec_file_prealloc ( RecFile *file, uint64_t end )
+{
+	while ( ( file->flags & REC_FILE_PREALLOC ) && end > file->alloc )
+	{
+		// KEEP_SIZE: the file size stays what was written, readers see no zero tail
+		if ( fallocate ( file->fd, FALLOC_FL_KEEP_SIZE, (off_t)file->alloc, PREALLOC_SIZE ) == -1 )
+		{
+			if ( errno != EOPNOTSUPP ) perror ( "fallocate" );
+
+			file->flags &= (uint8_t)~REC_FILE_PREALLOC;
+
+			return;
+		}
+
+		file->alloc += PREALLOC_SIZE;
+	}
+}
+
+static void rec_file_write_behind ( RecFile *file )
+{
+	while ( file->offset - file->wb_start >= WB_SIZE )
+	{
+		// Start writeback of this window, wait for the previous one and drop it from the page cache
+		sync_file_range ( file->fd, (off_t)file->wb_start, WB_SIZE, SYNC_FILE_RANGE_WRITE );
+
+		if ( file->wb_start >= WB_SIZE )
+		{
+			off_t prev = (off_t)( file->wb_start - WB_SIZE );
+
+			sync_file_range ( file->fd, prev, WB_SIZE, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+			posix_fadvise ( file->fd, prev, WB_SIZE, POSIX_FADV_DONTNEED );
+		}
+
+		file->wb_start += WB_SIZE;
+	}
+}
+
+gboolean rec_file_write ( RecFile *file, const uint8_t *buf, uint32_t len )
+{
+	if ( !( file->flags & REC_FILE_DIRECT ) )
+	{
+		rec_file_prealloc ( file, file->offset + len );
+
+		if ( !rec_file_pwrite ( file, buf, len ) ) return FALSE;
+
+		file->offset += len;
+
+		if ( file->flags & REC_FILE_PREALLOC ) rec_file_write_behind ( file );
+
+		return TRUE;
+	}
+
+	while ( len )
+	{
+		uint32_t n = MIN ( len, STAGE_SIZE - file->stage_len );
+
+		memcpy ( file->stage + file->stage_len, buf, n );
+
+		file->stage_len += n;
+		buf += n;
+		len -= n;
+
+		if ( file->stage_len < STAGE_SIZE ) break;
+
+		rec_file_prealloc ( file, file->offset + STAGE_SIZE );
+
+		if ( !rec_file_pwrite ( file, file->stage, STAGE_SIZE ) ) return FALSE;
+
+		file->offset += STAGE_SIZE;
+		file->stage_len = 0;
+	}
+
+	return TRUE;
+}
+
+void rec_file_free ( RecFile *file )
+{
+	if ( file->error ) { free ( file->stage ); free ( file ); return; }
+
+	if ( file->stage_len )
+	{
+		// The tail is not a whole number of pages
+		if ( fcntl ( file->fd, F_SETFL, fcntl ( file->fd, F_GETFL ) & ~O_DIRECT ) == -1 || !rec_file_pwrite ( file, file->stage, file->stage_len ) )
+			perror ( "Write rec_fd " );
+		else
+			file->offset += file->stage_len;
+	}
+
+	if ( file->flags & REC_FILE_PREALLOC )
+	{
+		if ( file->wb_start >= WB_SIZE ) file->wb_start -= WB_SIZE;
+
+		sync_file_range ( file->fd, (off_t)file->wb_start, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+		posix_fadvise ( file->fd, (off_t)file->wb_start, 0, POSIX_FADV_DONTNEED );
+	}
+
+	// Give back the extents past the end
+	if ( file->alloc > file->offset && ftruncate ( file->fd, (off_t)file->offset ) == -1 ) perror ( "ftruncate" );
+
+	free ( file->stage );
+	free ( file );
+}
+
+void rec_file_latency ( RecFile *file, uint32_t *p50, uint32_t *p99, uint32_t *max )
+{
+	*p50 = *p99 = *max = 0;
+
+	if ( !file->n_lat ) return;
+
+	uint64_t sum = 0;
+	gboolean half = FALSE;
+
+	uint32_t b = 0; for ( b = 0; b < LAT_BUCKETS; b++ )
+	{
+		sum += file->lat[b];
+
+		if ( !half && sum * 2 >= file->n_lat ) { *p50 = rec_file_lat_value ( b ); half = TRUE; }
+
+		if ( sum * 100 >= file->n_lat * 99 ) { *p99 = rec_file_lat_value ( b ); break; }
+	}
+
+	*max = file->lat_max;
+}
@@ -0,0 +1,36 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Sequential recording file: write ( ) with latency accounting and, on request,
+ * preallocation, write-behind that keeps the page cache clean, and O_DIRECT.
+ */
+
+enum rec_file_flags
+{
+	REC_FILE_PREALLOC = 1 << 0,
+	REC_FILE_DIRECT   = 1 << 1
+};
+
+typedef struct _RecFile RecFile;
+
+RecFile * rec_file_new ( int fd, uint8_t flags );
+
+// Writes all of buf, FALSE on error ( errno is set )
+gboolean rec_file_write ( RecFile *, const uint8_t *buf, uint32_t len );
+
+// Flushes what O_DIRECT holds back and trims the preallocation, unless a write failed; does not close the fd
+void rec_file_free ( RecFile * );
+
+// Write ( ) latency in us over the whole recording, 0 if nothing was written
+void rec_file_latency ( RecFile *, uint32_t *p50, uint32_t *p99, uint32_t *max );
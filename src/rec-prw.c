@@ -7,346 +7,1806 @@
 * http://www.gnu.org/licenses/gpl-2.0.html
 */
 
+#define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 
-#define BUF_SIZE ( 8 * 128 * 188 )
-
+#define BUF_SIZE ( 8 * 128 * TS_SIZE )
+#define READ_MAX ( 4 * BUF_SIZE )
+#define DMX_BUF_MAX ( 64 * BUF_SIZE ) // ~12 MB
+#define DVR_BUF_SIZE ( 10 * 188 * 1024 ) // kernel default
+#define MAX_EVENTS 32
+#define RING_SIZE  16 // MB
+#define URING_DEPTH 8
+
+#include "ts.h"
+#include "ring.h"
+#include "uring.h"
+#include "rec-file.h"
+#include "replay.h"
+#include "player.h"
+#include "stream.h"
+#include "rtp.h"
+#include "psi.h"
 #include "rec-prw.h"
 
 #include <fcntl.h>
 #include <time.h>
-#include <poll.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <linux/dvb/dmx.h>
 
+typedef struct _UringBlock UringBlock;
+
+struct _UringBlock
+{
+	const uint8_t *buf;
+	uint32_t len;
+	uint64_t offset;
+	uint8_t done;
+};
+
 typedef struct _DmxRecPrw DmxRecPrw;
+typedef struct _DmxSource DmxSource;
+
+struct _DmxSource
+{
+	int fd;
+	uint8_t adapter;
+	uint8_t demux;
+
+	// One tap per demux, shared by every dmx recording and preview: the PIDs are fanned out in software
+	gboolean shared;
+
+	uint16_t n_sinks;
+	uint16_t pid_ref[MAX_PID];
+
+	GSList *sinks; // reactor only
+
+	gboolean dvr;
+
+	Replay *replay;
+	char *name;
+	gboolean started;
+
+	uint32_t dmx_size; // kernel buffer
+	uint32_t read_size;
+	uint32_t resize;   // grown once a read has drained it
+
+	gboolean overflow;
+	uint64_t bitrate;
+	struct timespec mt1;
+
+	uint8_t *buf;
+	uint32_t carry;
+
+	uint16_t pkt_pid[READ_MAX / TS_SIZE];
+	uint16_t pkt_index[READ_MAX / TS_SIZE];
+};
 
 struct _DmxRecPrw
 {
-	int dmx_fd;
+	DmxSource *source;
+	uint32_t pids[MAX_PID / 32];
+
+	TsCheck *check;
+
 	int frp_fd;
+	RecFile *file;
 
 	char *fifo;
+	uint32_t fifo_off;    // written from the tail block
+	uint32_t fifo_blocks;
+	gboolean fifo_sync;   // dropped: restart at a random access point
+	uint64_t fifo_drop;
+	uint8_t  fifo_part[TS_SIZE]; // rest of a packet cut by the drop
+	uint32_t fifo_part_len;
+
+	Stream *stream; // preview served to any number of loopback clients
+
+	Rtp *net;         // rec to udp:// rtp://, datagrams on frp_fd
+	uint32_t net_off; // sent from the tail block
+	uint8_t net_poll; // frp_fd in the writer epoll: 1 added, 2 waits for EPOLLOUT
+
+	Ring *ring;
+	int eof;
+
+	int pipe_fd[2];
+	int splice;
+	uint32_t pipe_size;
+
+	Uring *uring;
+	UringBlock *blocks;
+	uint32_t queued;
+	uint64_t offset;
+	gboolean wfail;
+
+	uint32_t bitrate;
+	uint64_t total;
+	struct timespec mt1;
+	uint32_t rate_seq; // PCR windows published
+
+	// monitor->sid: the PIDs follow the PAT and the PMT of the program
+	Psi *pat;
+	Psi *pmt;
+
+	MonitorStats stats; // reactor side, published every read
+	Monitor *monitor;
+};
 
-	GMutex mutex;
+typedef struct _Reactor Reactor;
 
-	Monitor *monitor;
+struct _Reactor
+{
+	int epoll_fd;
+	int event_fd;
+
+	GSList *list;
+	GAsyncQueue *queue;
+
+	uint8_t buf[BUF_SIZE];
+};
+
+typedef struct _Writer Writer;
+
+struct _Writer
+{
+	int epoll_fd; // event_fd, the full sockets
+	int event_fd;
+
+	GSList *list;
+	GAsyncQueue *queue;
 };
 
-static void dmx_rec_prw_pid_play ( const char *file )
+static Reactor *reactor = NULL;
+static Writer  *writer  = NULL;
+
+static GMutex  sources_lock;
+static GSList *sources = NULL;
+
+static int replay_start_all = 0;
+
+// Demux device with PID filters ( not dvr, not replay )
+static inline gboolean dmx_source_filter ( const DmxSource *src )
+{
+	return !src->dvr && !src->replay;
+}
+
+// ***** Monitor *****
+
+Monitor * monitor_new ( void )
+{
+	Monitor *monitor = g_new0 ( Monitor, 1 );
+
+	monitor->ref = 1;
+	monitor->active = 1;
+
+	return monitor;
+}
+
+Monitor * monitor_ref ( Monitor *monitor )
+{
+	g_atomic_int_inc ( &monitor->ref );
+
+	return monitor;
+}
+
+void monitor_unref ( Monitor *monitor )
 {
-	int pid = 0, SIZE = 1024;
+	if ( g_atomic_int_dec_and_test ( &monitor->ref ) ) free ( monitor );
+}
 
-	char line[SIZE];
+// Seqlock with a single writer: the counter is odd while the block changes
+static void monitor_publish ( int *seq, void *dst, const void *src, size_t size )
+{
+	g_atomic_int_inc ( seq );
+	memcpy ( dst, src, size );
+	g_atomic_int_inc ( seq );
+}
 
-	FILE *fp = popen ( "ps -T -f -o pid:1,args", "r" );
+static void monitor_snapshot ( int *seq, const void *src, void *dst, size_t size )
+{
+	int s = 0;
 
-	while ( !feof (fp) )
+	do
 	{
-		if ( fgets ( line, SIZE, fp ) )
-		{
-			if ( g_strrstr ( line, file ) ) pid = (int)strtoul ( line, NULL, 10 );
-		}
+		s = g_atomic_int_get ( seq );
+		memcpy ( dst, src, size );
+		__atomic_thread_fence ( __ATOMIC_ACQUIRE );
 	}
+	while ( ( s & 1 ) || s != g_atomic_int_get ( seq ) );
+}
 
-	pclose ( fp );
+void monitor_stats ( Monitor *monitor, MonitorStats *stats )
+{
+	MonitorStats write;
+
+	monitor_snapshot ( &monitor->seq_read,  &monitor->read,  stats,  sizeof ( MonitorStats ) );
+	monitor_snapshot ( &monitor->seq_write, &monitor->write, &write, sizeof ( MonitorStats ) );
+
+	stats->size_file = write.size_file;
+	stats->fifo_drop = write.fifo_drop;
+	stats->clients = write.clients;
+	stats->lat_p50 = write.lat_p50;
+	stats->lat_p99 = write.lat_p99;
+	stats->lat_max = write.lat_max;
+}
 
-	if ( pid ) kill ( pid, SIGINT );
+void monitor_pids ( Monitor *monitor, MonitorPids *pids )
+{
+	monitor_snapshot ( &monitor->seq_pids, &monitor->pids, pids, sizeof ( MonitorPids ) );
 }
 
-static gpointer dmx_rec_prw_thread ( DmxRecPrw *dmx_rp )
+static void dmx_rec_prw_publish ( DmxRecPrw *dmx_rp )
 {
-	g_mutex_init ( &dmx_rp->mutex );
+	monitor_publish ( &dmx_rp->monitor->seq_read, &dmx_rp->monitor->read, &dmx_rp->stats, sizeof ( MonitorStats ) );
+}
 
-	gboolean stop = FALSE;
+// Once per PCR window: the sizes are per PID, not per read
+static void dmx_rec_prw_publish_pids ( DmxRecPrw *dmx_rp )
+{
+	const TsCheck *chk = dmx_rp->check;
+	MonitorPids pids = { .n_clock = chk->n_clock };
 
-	uint8_t buf[BUF_SIZE];
-	ssize_t r = 0, w = 0;
-	uint32_t bitrate = 0;
-	uint64_t total   = 0;
+	uint32_t pid = 0; for ( pid = 0; pid < MAX_PID && pids.n_pid < MONITOR_PIDS; pid++ )
+	{
+		if ( !chk->rate[pid] ) continue;
 
-	struct timespec mt1, mt2;
-	clock_gettime ( CLOCK_MONOTONIC, &mt1 );
+		pids.pid[pids.n_pid++] = (MonitorPid){ (uint16_t)pid, chk->rate[pid] / 1000, chk->cc_error[pid] };
+	}
 
-	struct pollfd pfd;
-	pfd.fd = dmx_rp->dmx_fd;
-	pfd.events = POLLIN | POLLPRI | POLLERR;
+	dmx_rp->stats.pcr_bitrate = chk->rate_all / 1000;
+	dmx_rp->stats.pcr_interval = 0;
+	dmx_rp->stats.pcr_jitter = 0;
+	dmx_rp->stats.pcr_disc = 0;
 
-	while ( !stop )
+	uint8_t c = 0; for ( c = 0; c < chk->n_clock; c++ )
 	{
-		int ret = poll ( &pfd, 1, 10 );
+		const TsClock *clk = &chk->clock[c];
 
-		if ( ret == -1 )
-		{
-			if ( errno == EINTR ) continue;
+		pids.clock[c] = (MonitorClock){ clk->pid, clk->interval, clk->jitter, clk->disc };
 
-			printf ( "Demux device poll failure \n" );
+		dmx_rp->stats.pcr_interval = MAX ( dmx_rp->stats.pcr_interval, clk->interval );
+		dmx_rp->stats.pcr_jitter = MAX ( dmx_rp->stats.pcr_jitter, clk->jitter );
+		dmx_rp->stats.pcr_disc += clk->disc;
+	}
 
-			break;
-		}
+	monitor_publish ( &dmx_rp->monitor->seq_pids, &dmx_rp->monitor->pids, &pids, sizeof ( MonitorPids ) );
 
-		if ( pfd.revents == 0 ) continue;
+	dmx_rp->rate_seq = chk->rate_seq;
+}
 
-		r = read ( dmx_rp->dmx_fd, buf, sizeof(buf) );
+static void dmx_source_close_locked ( DmxSource *src )
+{
+	if ( src->fd == -1 ) return;
 
-		if ( r < 0 )
-		{
-			perror ( "Read dmx_fd" );
+	// End of stream for the Gui: the last second of errors is not published by the stats yet
+	GSList *l = NULL; for ( l = src->sinks; l; l = l->next )
+	{
+		DmxRecPrw *dmx_rp = (DmxRecPrw *)l->data;
 
-			if ( errno == EOVERFLOW ) continue;
+		dmx_rp->stats.cc_error  = dmx_rp->check->n_cc_error;
+		dmx_rp->stats.tei_error = dmx_rp->check->n_tei;
+		dmx_rp->stats.scrambled = dmx_rp->check->n_scrambled;
 
-			break;
-		}
+		dmx_rec_prw_publish ( dmx_rp );
 
-		w = write ( dmx_rp->frp_fd, buf, (size_t)r );
+		g_atomic_int_set ( &dmx_rp->monitor->eof, 1 );
+	}
 
-		if ( w == -1 )
-		{
-			if ( errno != EINTR ) { perror ( "Write rec_fd " ); break; }
-		}
+	epoll_ctl ( reactor->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL );
 
-		total += (uint32_t)r;
-		bitrate += (uint32_t)r;
+	close ( src->fd );
+	src->fd = -1;
+}
 
-		clock_gettime ( CLOCK_MONOTONIC, &mt2 );
+static void dmx_rec_prw_close ( DmxRecPrw *dmx_rp )
+{
+	g_mutex_lock ( &sources_lock );
 
-		if ( mt2.tv_sec > mt1.tv_sec )
-		{
-			// uint16_t t_ms = (uint16_t)( ( mt2.tv_sec * 1000 + mt2.tv_nsec / 1000000 ) - ( mt1.tv_sec * 1000 + mt1.tv_nsec / 1000000 ) );
-			// g_message ( "%s:: %u msec, %u Kbps", __func__, t_ms, bitrate / 128 );
+	dmx_source_close_locked ( dmx_rp->source );
 
-			g_mutex_lock ( &dmx_rp->mutex );
+	g_mutex_unlock ( &sources_lock );
+}
 
-			dmx_rp->monitor->size_file = total;
-			dmx_rp->monitor->bitrate = bitrate / 128;
+static void dmx_rec_prw_free ( DmxRecPrw *dmx_rp )
+{
+	if ( dmx_rp->file ) rec_file_free ( dmx_rp->file );
 
-			if ( !dmx_rp->monitor->active ) stop = TRUE;
+	if ( dmx_rp->frp_fd != -1 ) close ( dmx_rp->frp_fd );
 
-			g_mutex_unlock ( &dmx_rp->mutex );
+	if ( dmx_rp->fifo ) { player_stop ( dmx_rp->fifo ); remove ( dmx_rp->fifo ); free ( dmx_rp->fifo ); }
 
-			bitrate = 0;
-			clock_gettime ( CLOCK_MONOTONIC, &mt1 );
-		}
-	}
+	if ( dmx_rp->stream ) { player_stop ( stream_uri ( dmx_rp->stream ) ); stream_free ( dmx_rp->stream ); }
 
-	close ( dmx_rp->dmx_fd );
-	close ( dmx_rp->frp_fd );
+	if ( dmx_rp->net ) rtp_free ( dmx_rp->net );
 
-	if ( dmx_rp->fifo ) { dmx_rec_prw_pid_play ( dmx_rp->fifo ); remove ( dmx_rp->fifo ); free ( dmx_rp->fifo ); }
+	if ( dmx_rp->uring ) uring_free ( dmx_rp->uring );
 
-	free ( dmx_rp->monitor );
+	if ( dmx_rp->pipe_fd[0] != -1 ) close ( dmx_rp->pipe_fd[0] );
+	if ( dmx_rp->pipe_fd[1] != -1 ) close ( dmx_rp->pipe_fd[1] );
 
-	g_mutex_clear ( &dmx_rp->mutex );
+	ring_free ( dmx_rp->ring );
+
+	free ( dmx_rp->check );
+	free ( dmx_rp->blocks );
+	free ( dmx_rp->pat );
+	free ( dmx_rp->pmt );
+	monitor_unref ( dmx_rp->monitor );
 	free ( dmx_rp );
+}
 
-	return NULL;
+static void dmx_rec_prw_wakeup ( int event_fd )
+{
+	uint64_t val = 1;
+
+	if ( write ( event_fd, &val, sizeof(val) ) == -1 ) perror ( "Write event_fd" );
 }
 
-const char * dmx_prw_create ( uint8_t a, uint8_t d, const char *prw, uint8_t len_pid, uint16_t pids[], Monitor *monitor, const char *player )
+// ***** Writer *****
+
+static void dmx_rec_prw_publish_write ( DmxRecPrw *dmx_rp )
 {
-	struct dmx_pes_filter_params f;
+	MonitorStats stats = { .size_file = dmx_rp->total, .fifo_drop = dmx_rp->fifo_drop };
 
-	char dmxdev[PATH_MAX];
-	sprintf ( dmxdev, "/dev/dvb/adapter%i/demux%i", a, d );
+	if ( dmx_rp->stream ) stats.clients = stream_clients ( dmx_rp->stream );
 
-	int dmx_fd = open ( dmxdev, O_RDWR | O_NONBLOCK );
+	if ( dmx_rp->file ) rec_file_latency ( dmx_rp->file, &stats.lat_p50, &stats.lat_p99, &stats.lat_max );
 
-	if ( dmx_fd == -1 )
-	{
-		perror ( "Cannot open dmx device" );
+	monitor_publish ( &dmx_rp->monitor->seq_write, &dmx_rp->monitor->write, &stats, sizeof ( MonitorStats ) );
+}
 
-		return "Cannot open dmx device";
-	}
+static void dmx_rec_prw_write ( DmxRecPrw *dmx_rp )
+{
+	uint8_t *buf = NULL;
+	uint32_t len = 0;
 
-	if ( mkfifo ( prw, S_IRUSR | S_IWUSR ) < 0 )
+	while ( ( buf = ring_tail ( dmx_rp->ring, &len ) ) )
 	{
-		perror ( "Cannot create FIFO" );
-		close ( dmx_fd );
+		if ( dmx_rp->file && !rec_file_write ( dmx_rp->file, buf, len ) )
+		{
+			perror ( "Write rec_fd " );
 
-		return "Cannot create FIFO";
+			rec_file_free ( dmx_rp->file );
+			dmx_rp->file = NULL;
+
+			close ( dmx_rp->frp_fd );
+			dmx_rp->frp_fd = -1;
+		}
+
+		if ( dmx_rp->file ) dmx_rp->total += len;
+
+		ring_pop ( dmx_rp->ring );
 	}
 
-	int prw_fd = open ( prw, O_RDWR );
+	dmx_rec_prw_publish_write ( dmx_rp );
+}
 
-	if ( prw_fd == -1 )
+static void dmx_rec_prw_fifo_drop ( DmxRecPrw *dmx_rp, uint32_t keep )
+{
+	uint32_t len = 0;
+	uint8_t *buf = ring_tail ( dmx_rp->ring, &len );
+
+	// The player already has the start of this packet: it gets the rest too
+	uint32_t cut = ( buf ) ? dmx_rp->fifo_off % TS_SIZE : 0;
+
+	if ( cut && keep && dmx_rp->fifo_part_len == 0 && dmx_rp->fifo_off + TS_SIZE - cut <= len )
 	{
-		perror ( "Cannot open FIFO" );
+		dmx_rp->fifo_part_len = TS_SIZE - cut;
+		memcpy ( dmx_rp->fifo_part, buf + dmx_rp->fifo_off, dmx_rp->fifo_part_len );
+		dmx_rp->fifo_off += dmx_rp->fifo_part_len;
+	}
 
-		return "Cannot open FIFO";
+	while ( ring_fill ( dmx_rp->ring ) > keep && ring_tail ( dmx_rp->ring, &len ) )
+	{
+		dmx_rp->fifo_drop += len - dmx_rp->fifo_off;
+		dmx_rp->fifo_off = 0;
+
+		ring_pop ( dmx_rp->ring );
 	}
 
-	memset(&f, 0, sizeof(f));
-	f.pid = pids[0];
-	f.input = DMX_IN_FRONTEND;
-	f.output = DMX_OUT_TSDEMUX_TAP;
-	f.pes_type = DMX_PES_OTHER;
+	dmx_rp->fifo_sync = TRUE;
+}
 
-	if ( ioctl ( dmx_fd, DMX_SET_BUFFER_SIZE, BUF_SIZE ) != 0 ) perror ( "DMX_SET_BUFFER_SIZE" );
+// Preview: the FIFO is non-blocking, a stalled player never holds the writer
+// Drop newest: the ring fills up and the reactor counts the drop. Drop oldest: make room from the tail
+static void dmx_rec_prw_fifo_full ( DmxRecPrw *dmx_rp )
+{
+	if ( errno != EAGAIN ) perror ( "Write FIFO " );
 
-	if ( ioctl ( dmx_fd, DMX_SET_PES_FILTER, &f ) == -1 )
+	if ( dmx_rp->monitor->prw_drop == PRW_DROP_OLDEST && ring_fill ( dmx_rp->ring ) * 4 >= dmx_rp->fifo_blocks * 3 )
+		dmx_rec_prw_fifo_drop ( dmx_rp, dmx_rp->fifo_blocks / 4 );
+
+	dmx_rec_prw_publish_write ( dmx_rp );
+}
+
+static void dmx_rec_prw_write_fifo ( DmxRecPrw *dmx_rp )
+{
+	uint8_t *buf = NULL;
+	uint32_t len = 0;
+
+	while ( dmx_rp->fifo_part_len )
 	{
-		perror ( "DMX_SET_PES_FILTER" );
-		close ( prw_fd );
-		close ( dmx_fd );
-		remove ( prw );
+		ssize_t w = write ( dmx_rp->frp_fd, dmx_rp->fifo_part + TS_SIZE - dmx_rp->fifo_part_len, dmx_rp->fifo_part_len );
+
+		if ( w == -1 && errno == EINTR ) continue;
 
-		return "Eroor: DMX_SET_PES_FILTER";
+		if ( w == -1 ) { dmx_rec_prw_fifo_full ( dmx_rp ); return; }
+
+		dmx_rp->fifo_part_len -= (uint32_t)w;
+		dmx_rp->total += (uint64_t)w;
 	}
 
-	uint8_t i = 0; for ( i = 0; i < len_pid; i++ )
+	while ( ( buf = ring_tail ( dmx_rp->ring, &len ) ) )
 	{
-		if ( pids[i] == 0 ) continue;
-
-		if ( ioctl ( dmx_fd, DMX_ADD_PID, &pids[i] ) == -1 )
+		if ( dmx_rp->fifo_sync )
 		{
-			perror ( "DMX_ADD_PID" );
+			dmx_rp->fifo_off = ts_access_point ( buf, len );
+			dmx_rp->fifo_drop += dmx_rp->fifo_off;
+			dmx_rp->fifo_sync = FALSE;
 		}
+
+		ssize_t w = write ( dmx_rp->frp_fd, buf + dmx_rp->fifo_off, len - dmx_rp->fifo_off );
+
+		if ( w == -1 && errno == EINTR ) continue;
+
+		if ( w == -1 ) { dmx_rec_prw_fifo_full ( dmx_rp ); return; }
+
+		dmx_rp->fifo_off += (uint32_t)w;
+		dmx_rp->total += (uint64_t)w;
+
+		if ( dmx_rp->fifo_off == len ) { ring_pop ( dmx_rp->ring ); dmx_rp->fifo_off = 0; }
 	}
 
-	if ( ioctl ( dmx_fd, DMX_START ) == -1 )
+	dmx_rec_prw_publish_write ( dmx_rp );
+}
+
+// Every block goes to every client ring at once: the fan-out never waits for a client
+static void dmx_rec_prw_write_stream ( DmxRecPrw *dmx_rp )
+{
+	uint8_t *buf = NULL;
+	uint32_t len = 0;
+
+	while ( ( buf = ring_tail ( dmx_rp->ring, &len ) ) )
 	{
-		perror ( "DMX_START" );
-		close ( prw_fd );
-		close ( dmx_fd );
-		remove ( prw );
+		stream_write ( dmx_rp->stream, buf, len );
 
-		return "Eroor: DMX_START";
+		dmx_rp->total += len;
+		ring_pop ( dmx_rp->ring );
 	}
 
-	DmxRecPrw *dmx_rp = g_new0 ( DmxRecPrw, 1 );
+	stream_flush ( dmx_rp->stream );
 
-	dmx_rp->dmx_fd = dmx_fd;
-	dmx_rp->frp_fd = prw_fd;
-	dmx_rp->fifo = g_strdup ( prw );
-	dmx_rp->monitor = monitor;
+	dmx_rp->fifo_drop = stream_drop ( dmx_rp->stream );
+	dmx_rec_prw_publish_write ( dmx_rp );
+}
 
-	GThread *thread = g_thread_new ( NULL, (GThreadFunc)dmx_rec_prw_thread, dmx_rp );
-	g_thread_unref ( thread );
+// A full socket keeps the rest of the block for the next wakeup; a send error loses the block, not the sink
+static void dmx_rec_prw_write_net ( DmxRecPrw *dmx_rp )
+{
+	uint8_t *buf = NULL;
+	uint32_t len = 0;
 
-	char play[PATH_MAX];
-	sprintf ( play, "%s '%s'", player, prw );
+	while ( ( buf = ring_tail ( dmx_rp->ring, &len ) ) )
+	{
+		ssize_t w = rtp_send ( dmx_rp->net, dmx_rp->frp_fd, NULL, 0, buf + dmx_rp->net_off, len - dmx_rp->net_off );
 
-	GAppInfo *app = g_app_info_create_from_commandline ( play, NULL, G_APP_INFO_CREATE_NONE, NULL );
+		if ( w == -1 )
+		{
+			// Unicast without a receiver: ICMP port unreachable on every other send
+			if ( errno != ECONNREFUSED ) perror ( "Send rtp " );
 
-	GError *error = NULL;
-	g_app_info_launch ( app, NULL, NULL, &error );
+			dmx_rp->fifo_drop += len - dmx_rp->net_off;
+			w = len - dmx_rp->net_off;
+		}
+		else
+			dmx_rp->total += (uint64_t)w;
 
-	if ( error ) { g_warning ( "%s: %s", __func__, error->message ); g_error_free ( error ); }
+		dmx_rp->net_off += (uint32_t)w;
 
-	g_object_unref ( app );
+		// Less than a packet left is not sent
+		if ( len - dmx_rp->net_off >= TS_SIZE ) break;
 
-	return NULL;
+		ring_pop ( dmx_rp->ring );
+		dmx_rp->net_off = 0;
+	}
+
+	dmx_rec_prw_publish_write ( dmx_rp );
 }
 
-const char * dmx_rec_create ( uint8_t a, uint8_t d, const char *rec, uint8_t len_pid, uint16_t pids[], Monitor *monitor )
+static uint32_t dmx_rec_prw_pipe_fill ( DmxRecPrw *dmx_rp )
 {
-	struct dmx_pes_filter_params f;
+	int n = 0;
 
-	char dmxdev[PATH_MAX];
-	sprintf ( dmxdev, "/dev/dvb/adapter%i/demux%i", a, d );
+	if ( ioctl ( dmx_rp->pipe_fd[0], FIONREAD, &n ) == -1 ) return 0;
 
-	int dmx_fd = open ( dmxdev, O_RDWR | O_NONBLOCK );
+	return (uint32_t)n;
+}
 
-	if ( dmx_fd == -1 )
+static uint32_t dmx_rec_prw_fill ( DmxRecPrw *dmx_rp )
+{
+	if ( dmx_rp->pipe_fd[0] != -1 && dmx_rec_prw_pipe_fill ( dmx_rp ) ) return 1;
+
+	return ring_fill ( dmx_rp->ring );
+}
+
+static void dmx_rec_prw_write_splice ( DmxRecPrw *dmx_rp )
+{
+	while ( TRUE )
 	{
-		perror ( "Cannot open dmx device" );
+		ssize_t w = splice ( dmx_rp->pipe_fd[0], NULL, dmx_rp->frp_fd, NULL, BUF_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
 
-		return "Cannot open dmx device";
-	}
+		if ( w == -1 )
+		{
+			if ( errno == EINTR ) continue;
+			if ( errno == EAGAIN ) break;
 
-	int rec_fd = open ( rec, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0664 );
+			perror ( "Splice rec_fd " );
 
-	if ( rec_fd == -1 )
-	{
-		perror ( "Cannot open rec file" );
-		close ( dmx_fd );
+			// Same as write ( ): keep draining the pipe but drop the data
+			close ( dmx_rp->frp_fd );
+			dmx_rp->frp_fd = open ( "/dev/null", O_WRONLY );
+
+			break;
+		}
 
-		return "Cannot open rec file";
+		if ( w == 0 ) break;
+
+		dmx_rp->total += (uint64_t)w;
 	}
 
-	memset(&f, 0, sizeof(f));
-	f.pid = 0;
-	f.input = DMX_IN_FRONTEND;
-	f.output = DMX_OUT_TSDEMUX_TAP;
-	f.pes_type = DMX_PES_OTHER;
+	dmx_rec_prw_publish_write ( dmx_rp );
+}
 
-	if ( ioctl ( dmx_fd, DMX_SET_BUFFER_SIZE, BUF_SIZE ) != 0 ) perror ( "DMX_SET_BUFFER_SIZE" );
+static void dmx_rec_prw_uring_done ( uint64_t index, int res, DmxRecPrw *dmx_rp )
+{
+	UringBlock *blk = &dmx_rp->blocks[index];
 
-	if ( ioctl ( dmx_fd, DMX_SET_PES_FILTER, &f ) == -1 )
+	if ( res < 0 )
 	{
-		perror ( "DMX_SET_PES_FILTER" );
-		close ( rec_fd );
-		close ( dmx_fd );
+		g_warning ( "%s:: Write rec_fd: %s ", __func__, g_strerror ( -res ) );
 
-		return "Eroor: DMX_SET_PES_FILTER";
+		dmx_rp->wfail = TRUE;
 	}
-
-	uint8_t i = 0; for ( i = 0; i < len_pid; i++ )
+	else
 	{
-		if ( pids[i] == 0 ) continue;
+		ssize_t w = 0;
 
-		if ( ioctl ( dmx_fd, DMX_ADD_PID, &pids[i] ) == -1 )
+		// Short write ( disk full or signal ): finish the block synchronously
+		if ( (uint32_t)res < blk->len && !dmx_rp->wfail )
 		{
-			perror ( "DMX_ADD_PID" );
+			w = pwrite ( dmx_rp->frp_fd, blk->buf + res, blk->len - (uint32_t)res, (off_t)( blk->offset + (uint64_t)res ) );
+
+			if ( w != (ssize_t)( blk->len - (uint32_t)res ) ) { perror ( "Write rec_fd " ); dmx_rp->wfail = TRUE; }
 		}
+
+		// Only what reached the file
+		dmx_rp->total += (uint64_t)res + (uint64_t)MAX ( w, 0 );
 	}
 
-	if ( ioctl ( dmx_fd, DMX_START ) == -1 )
+	blk->done = 1;
+}
+
+static void dmx_rec_prw_write_uring ( DmxRecPrw *dmx_rp )
+{
+	uint8_t *buf = NULL;
+	uint32_t len = 0, index = 0;
+
+	uring_reap ( dmx_rp->uring, (UringDone)dmx_rec_prw_uring_done, dmx_rp );
+	dmx_rec_prw_publish_write ( dmx_rp );
+
+	// Blocks complete in any order, the ring is released in order
+	while ( ring_peek ( dmx_rp->ring, 0, &len, &index ) && dmx_rp->blocks[index].done )
 	{
-		perror ( "DMX_START" );
-		close ( rec_fd );
-		close ( dmx_fd );
+		dmx_rp->blocks[index].done = 0;
+		dmx_rp->queued--;
 
-		return "Eroor: DMX_START";
+		ring_pop ( dmx_rp->ring );
 	}
 
-	DmxRecPrw *dmx_rp = g_new0 ( DmxRecPrw, 1 );
+	if ( dmx_rp->wfail )
+	{
+		// Nothing in flight anymore: drop the rest instead of writing it
+		while ( dmx_rp->queued == 0 && ring_tail ( dmx_rp->ring, &len ) ) ring_pop ( dmx_rp->ring );
 
-	dmx_rp->dmx_fd = dmx_fd;
-	dmx_rp->frp_fd = rec_fd;
-	dmx_rp->fifo = NULL;
-	dmx_rp->monitor = monitor;
+		return;
+	}
 
-	GThread *thread = g_thread_new ( NULL, (GThreadFunc)dmx_rec_prw_thread, dmx_rp );
-	g_thread_unref ( thread );
+	while ( dmx_rp->queued < URING_DEPTH && ( buf = ring_peek ( dmx_rp->ring, dmx_rp->queued, &len, &index ) ) )
+	{
+		if ( !uring_write ( dmx_rp->uring, buf, len, dmx_rp->offset, (int)index, index ) ) break;
 
-	return NULL;
+		dmx_rp->blocks[index].buf = buf;
+		dmx_rp->blocks[index].len = len;
+		dmx_rp->blocks[index].offset = dmx_rp->offset;
+
+		dmx_rp->offset += len;
+		dmx_rp->queued++;
+	}
+
+	uring_submit ( dmx_rp->uring );
 }
 
-const char * dvr_rec_create ( const char *dvr, const char *rec, Monitor *monitor )
+static void dmx_rec_prw_writer_add ( Writer *wr, DmxRecPrw *dmx_rp )
 {
-	int dvr_fd = open ( dvr, O_RDONLY );
+	gboolean file = ( !dmx_rp->fifo && !dmx_rp->stream && !dmx_rp->net );
 
-	if ( dvr_fd == -1 )
+	if ( dmx_rp->monitor->writer == REC_WRITER_URING && file )
 	{
-		perror ( "Cannot open dvr device" );
+		uint32_t n_blocks = 0, block_size = 0;
+		uint8_t *data = ring_data ( dmx_rp->ring, &n_blocks, &block_size );
 
-		return "Cannot open dvr device";
+		dmx_rp->uring = uring_new ( dmx_rp->frp_fd, wr->event_fd, URING_DEPTH, data, n_blocks, block_size );
+
+		if ( dmx_rp->uring )
+			dmx_rp->blocks = g_new0 ( UringBlock, n_blocks );
+		else
+			g_message ( "%s:: io_uring is not available, using write ( ).", __func__ );
 	}
 
-	int rec_fd = open ( rec, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0664 );
+	uint8_t flags = 0;
+
+	if ( file && dmx_rp->monitor->writer == REC_WRITER_PREALLOC ) flags = REC_FILE_PREALLOC;
+	if ( file && dmx_rp->monitor->writer == REC_WRITER_DIRECT  ) flags = REC_FILE_PREALLOC | REC_FILE_DIRECT;
+
+	uint32_t block_size = 0;
+
+	if ( dmx_rp->fifo ) ring_data ( dmx_rp->ring, &dmx_rp->fifo_blocks, &block_size );
+
+	// splice ( ) may still fall back to the ring
+	if ( !dmx_rp->uring && file ) dmx_rp->file = rec_file_new ( dmx_rp->frp_fd, flags );
+
+	wr->list = g_slist_prepend ( wr->list, dmx_rp );
+}
+
+// A full socket: the writer comes round again once it drains, without a wakeup of its own
+static void dmx_rec_prw_writer_poll ( Writer *wr, DmxRecPrw *dmx_rp )
+{
+	struct epoll_event ev;
+	ev.events = EPOLLOUT | EPOLLONESHOT;
+	ev.data.ptr = dmx_rp;
+
+	if ( epoll_ctl ( wr->epoll_fd, ( dmx_rp->net_poll ) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, dmx_rp->frp_fd, &ev ) == -1 ) { perror ( "Writer epoll_ctl" ); return; }
+
+	dmx_rp->net_poll = 2;
+}
+
+static gpointer dmx_rec_prw_writer ( Writer *wr )
+{
+	struct epoll_event events[MAX_EVENTS];
 
-	if ( rec_fd == -1 )
+	while ( TRUE )
 	{
-		perror ( "Cannot open rec file" );
-		close ( dvr_fd );
+		int n = epoll_wait ( wr->epoll_fd, events, MAX_EVENTS, -1 );
 
-		return "Cannot open rec file";
-	}
+		if ( n == -1 )
+		{
+			if ( errno == EINTR ) continue;
 
-	DmxRecPrw *dmx_rp = g_new0 ( DmxRecPrw, 1 );
+			perror ( "Writer epoll_wait" );
+
+			break;
+		}
 
-	dmx_rp->dmx_fd = dvr_fd;
-	dmx_rp->frp_fd = rec_fd;
-	dmx_rp->fifo = NULL;
-	dmx_rp->monitor = monitor;
+		int i = 0; for ( i = 0; i < n; i++ )
+		{
+			DmxRecPrw *dmx_rp = (DmxRecPrw *)events[i].data.ptr;
 
-	GThread *thread = g_thread_new ( NULL, (GThreadFunc)dmx_rec_prw_thread, dmx_rp );
-	g_thread_unref ( thread );
+			if ( dmx_rp ) { dmx_rp->net_poll = 1; continue; }
 
-	return NULL;
+			uint64_t val = 0;
+
+			if ( read ( wr->event_fd, &val, sizeof(val) ) == -1 && errno != EAGAIN ) perror ( "Writer read event_fd" );
+		}
+
+		DmxRecPrw *dmx_rp = NULL;
+
+		while ( ( dmx_rp = g_async_queue_try_pop ( wr->queue ) ) ) dmx_rec_prw_writer_add ( wr, dmx_rp );
+
+		GSList *l = wr->list;
+
+		while ( l )
+		{
+			GSList *next = l->next;
+			dmx_rp = (DmxRecPrw *)l->data;
+
+			// Read eof first: once it is set the reader will not push anymore
+			int eof = g_atomic_int_get ( &dmx_rp->eof );
+
+			if ( dmx_rp->pipe_fd[0] != -1 )
+				dmx_rec_prw_write_splice ( dmx_rp );
+
+			if ( dmx_rp->uring )
+				dmx_rec_prw_write_uring ( dmx_rp );
+			else if ( dmx_rp->fifo )
+				dmx_rec_prw_write_fifo ( dmx_rp );
+			else if ( dmx_rp->stream )
+				dmx_rec_prw_write_stream ( dmx_rp );
+			else if ( dmx_rp->net )
+				dmx_rec_prw_write_net ( dmx_rp );
+			else
+				dmx_rec_prw_write ( dmx_rp );
+
+			// A stopped preview does not wait for the player to take the rest
+			if ( eof && dmx_rp->fifo ) dmx_rec_prw_fifo_drop ( dmx_rp, 0 );
+
+			if ( dmx_rp->net && dmx_rp->net_poll != 2 && ring_fill ( dmx_rp->ring ) ) dmx_rec_prw_writer_poll ( wr, dmx_rp );
+
+			if ( eof && dmx_rec_prw_fill ( dmx_rp ) == 0 )
+			{
+				if ( dmx_rp->net_poll ) epoll_ctl ( wr->epoll_fd, EPOLL_CTL_DEL, dmx_rp->frp_fd, NULL );
+
+				wr->list = g_slist_delete_link ( wr->list, l );
+				dmx_rec_prw_free ( dmx_rp );
+			}
+
+			l = next;
+		}
+	}
+
+	return NULL;
+}
+
+// ***** Reactor *****
+
+static void dmx_rec_prw_stats ( DmxRecPrw *dmx_rp, ssize_t r )
+{
+	dmx_rp->bitrate += (uint32_t)r;
+
+	struct timespec mt2;
+	clock_gettime ( CLOCK_MONOTONIC, &mt2 );
+
+	if ( mt2.tv_sec > dmx_rp->mt1.tv_sec )
+	{
+		dmx_rp->stats.bitrate = dmx_rp->bitrate / 128;
+
+		if ( g_atomic_int_get ( &dmx_rp->splice ) )
+			dmx_rp->stats.ring_hwm = (uint8_t)MAX ( dmx_rp->stats.ring_hwm, dmx_rec_prw_pipe_fill ( dmx_rp ) * 100 / dmx_rp->pipe_size );
+		else
+			dmx_rp->stats.ring_hwm = ring_hwm ( dmx_rp->ring );
+
+		dmx_rp->stats.dmx_size  = dmx_rp->source->dmx_size / 1024;
+		dmx_rp->stats.cc_error  = dmx_rp->check->n_cc_error;
+		dmx_rp->stats.tei_error = dmx_rp->check->n_tei;
+		dmx_rp->stats.scrambled = dmx_rp->check->n_scrambled;
+
+		dmx_rp->bitrate = 0;
+		dmx_rp->mt1 = mt2;
+	}
+
+	if ( dmx_rp->rate_seq != dmx_rp->check->rate_seq ) dmx_rec_prw_publish_pids ( dmx_rp );
+
+	dmx_rec_prw_publish ( dmx_rp );
+}
+
+static void dmx_source_overflow ( DmxSource *src )
+{
+	GSList *l = NULL; for ( l = src->sinks; l; l = l->next ) ( (DmxRecPrw *)l->data )->stats.dmx_overflow++;
+
+	src->overflow = TRUE;
+}
+
+static void dmx_source_resize ( DmxSource *src, uint32_t size )
+{
+	size = MIN ( size, DMX_BUF_MAX );
+
+	if ( size <= src->dmx_size || src->replay ) return;
+
+	g_mutex_lock ( &sources_lock );
+
+	if ( src->fd == -1 ) { g_mutex_unlock ( &sources_lock ); return; }
+
+	// A running demux filter refuses a new size ( EBUSY ); the dvr device does not. Both flush the buffer: counted as an overflow
+	if ( !src->dvr && ioctl ( src->fd, DMX_STOP ) == -1 ) perror ( "DMX_STOP" );
+
+	GSList *l = NULL; for ( l = src->sinks; l; l = l->next ) ( (DmxRecPrw *)l->data )->stats.dmx_overflow++;
+
+	if ( ioctl ( src->fd, DMX_SET_BUFFER_SIZE, size ) == -1 )
+		perror ( "DMX_SET_BUFFER_SIZE" );
+	else
+		src->dmx_size = size;
+
+	if ( !src->dvr && ioctl ( src->fd, DMX_START ) == -1 ) { perror ( "DMX_START" ); dmx_source_close_locked ( src ); }
+
+	g_mutex_unlock ( &sources_lock );
+}
+
+// drained: the read took less than it asked for, the kernel buffer is empty
+static void dmx_source_stats ( DmxSource *src, ssize_t r, gboolean drained )
+{
+	src->bitrate += (uint64_t)r;
+
+	// Not on the read after an overflow: the flush would lose what is still queued
+	if ( src->resize && drained ) { dmx_source_resize ( src, src->resize ); src->resize = 0; }
+
+	struct timespec mt2;
+	clock_gettime ( CLOCK_MONOTONIC, &mt2 );
+
+	if ( mt2.tv_sec <= src->mt1.tv_sec ) return;
+
+	// Only grow: every resize restarts the filter. The kernel buffer holds ~ 250 ms, twice as much after an overflow
+	uint32_t size = (uint32_t)MIN ( ( src->bitrate / 4 + BUF_SIZE - 1 ) / BUF_SIZE * BUF_SIZE, DMX_BUF_MAX );
+
+	if ( src->overflow ) size = MAX ( size, src->dmx_size * 2 );
+
+	if ( size > src->dmx_size ) src->resize = size;
+
+	// One read takes ~ 40 ms of the stream
+	src->read_size = (uint32_t)CLAMP ( src->bitrate / 25 / TS_SIZE * TS_SIZE, BUF_SIZE, READ_MAX );
+
+	src->overflow = FALSE;
+	src->bitrate = 0;
+	src->mt1 = mt2;
+}
+
+static gboolean dmx_rec_prw_read_splice ( DmxRecPrw *dmx_rp, uint8_t *scratch )
+{
+	ssize_t r = splice ( dmx_rp->source->fd, NULL, dmx_rp->pipe_fd[1], NULL, BUF_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+
+	if ( r == -1 && errno == EINVAL && dmx_rp->splice == 1 )
+	{
+		// The dvb driver has no splice_read: nothing went through the pipe yet, switch to the ring
+		g_message ( "%s:: splice is not supported by this device, using read ( ).", __func__ );
+
+		g_atomic_int_set ( &dmx_rp->splice, 0 );
+
+		return FALSE;
+	}
+
+	if ( r == -1 && errno == EAGAIN )
+	{
+		// Pipe full: drain the demux and count the drop like a full ring
+		r = read ( dmx_rp->source->fd, scratch, BUF_SIZE );
+
+		if ( r > 0 ) { dmx_rp->stats.ring_drop += (uint64_t)r; dmx_rec_prw_stats ( dmx_rp, r ); dmx_source_stats ( dmx_rp->source, r, ( r < BUF_SIZE ) ); }
+
+		return TRUE;
+	}
+
+	if ( r == -1 && errno == EOVERFLOW ) { dmx_source_overflow ( dmx_rp->source ); return TRUE; }
+
+	if ( r <= 0 )
+	{
+		if ( r == -1 ) perror ( "Splice dmx_fd" );
+
+		if ( r == -1 && errno == EINTR ) return TRUE;
+
+		dmx_rec_prw_close ( dmx_rp );
+
+		return TRUE;
+	}
+
+	// 1 - not tested yet, 2 - the device splices
+	if ( dmx_rp->splice == 1 ) g_atomic_int_set ( &dmx_rp->splice, 2 );
+
+	dmx_rec_prw_wakeup ( writer->event_fd );
+	dmx_rec_prw_stats ( dmx_rp, r );
+	dmx_source_stats ( dmx_rp->source, r, ( r < BUF_SIZE ) );
+
+	return TRUE;
+}
+
+static void dmx_rec_prw_read ( DmxRecPrw *dmx_rp, uint8_t *scratch )
+{
+	if ( dmx_rp->pipe_fd[1] != -1 )
+	{
+		if ( dmx_rec_prw_read_splice ( dmx_rp, scratch ) ) return;
+
+		close ( dmx_rp->pipe_fd[1] );
+		dmx_rp->pipe_fd[1] = -1;
+	}
+
+	uint8_t *buf = ring_head ( dmx_rp->ring );
+
+	// Ring full: keep draining the demux so the drop is counted here and not lost in the kernel
+	gboolean full = ( buf == NULL );
+
+	ssize_t r = read ( dmx_rp->source->fd, ( full ) ? scratch : buf, BUF_SIZE );
+
+	if ( r == -1 && errno == EOVERFLOW ) { dmx_source_overflow ( dmx_rp->source ); return; }
+
+	if ( r <= 0 )
+	{
+		if ( r == -1 ) perror ( "Read dmx_fd" );
+
+		if ( r == -1 && ( errno == EAGAIN || errno == EINTR ) ) return;
+
+		// Keep the monitor alive until the Gui asks to stop
+		dmx_rec_prw_close ( dmx_rp );
+
+		return;
+	}
+
+	if ( full )
+		dmx_rp->stats.ring_drop += (uint64_t)r;
+	else
+	{
+		ts_check_buf ( dmx_rp->check, buf, (uint32_t)r );
+
+		ring_push ( dmx_rp->ring, (uint32_t)r );
+		dmx_rec_prw_wakeup ( writer->event_fd );
+
+		dmx_rp->stats.size_read += (uint64_t)r;
+		dmx_rp->stats.packets += (uint64_t)r / TS_SIZE;
+	}
+
+	dmx_rec_prw_stats ( dmx_rp, r );
+	dmx_source_stats ( dmx_rp->source, r, ( r < BUF_SIZE ) );
+}
+
+// A new PID set of the program: the filters of the shared tap follow, the capture goes on
+static void dmx_rec_prw_set_pids ( DmxRecPrw *dmx_rp, const uint32_t *pids )
+{
+	DmxSource *src = dmx_rp->source;
+
+	g_mutex_lock ( &sources_lock );
+
+	uint16_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ )
+	{
+		gboolean old = ts_bitmap_test ( dmx_rp->pids, pid ), new = ts_bitmap_test ( pids, pid );
+
+		if ( old == new ) continue;
+
+		if ( new && src->pid_ref[pid]++ == 0 && src->fd != -1 && dmx_source_filter ( src ) && ioctl ( src->fd, DMX_ADD_PID, &pid ) == -1 ) perror ( "DMX_ADD_PID" );
+
+		if ( old && --src->pid_ref[pid] == 0 && src->fd != -1 && dmx_source_filter ( src ) && ioctl ( src->fd, DMX_REMOVE_PID, &pid ) == -1 ) perror ( "DMX_REMOVE_PID" );
+	}
+
+	memcpy ( dmx_rp->pids, pids, sizeof ( dmx_rp->pids ) );
+
+	g_mutex_unlock ( &sources_lock );
+}
+
+static void dmx_rec_prw_pat ( DmxRecPrw *dmx_rp, const uint8_t *sec, uint32_t len )
+{
+	uint16_t pmt_pid = MAX_PID;
+
+	uint32_t i = 0; for ( i = 8; i + 4 <= len - 4; i += 4 )
+	{
+		const uint8_t *p = sec + i;
+
+		if ( ( ( p[0] << 8 ) | p[1] ) == dmx_rp->monitor->sid ) pmt_pid = (uint16_t)( ( ( p[2] & 0x1F ) << 8 ) | p[3] );
+	}
+
+	if ( pmt_pid == MAX_PID || pmt_pid == dmx_rp->pmt->pid ) return;
+
+	// The old PMT PID goes, the elementary PIDs stay until the new PMT
+	uint32_t pids[MAX_PID / 32];
+	memcpy ( pids, dmx_rp->pids, sizeof ( pids ) );
+
+	if ( dmx_rp->pmt->pid < MAX_PID ) pids[dmx_rp->pmt->pid / 32] &= ~( 1u << ( dmx_rp->pmt->pid % 32 ) );
+
+	ts_bitmap_set ( pids, pmt_pid );
+
+	psi_init ( dmx_rp->pmt, pmt_pid );
+	dmx_rec_prw_set_pids ( dmx_rp, pids );
+}
+
+static void dmx_rec_prw_pmt ( DmxRecPrw *dmx_rp, const uint8_t *sec, uint32_t len )
+{
+	if ( ( ( sec[3] << 8 ) | sec[4] ) != dmx_rp->monitor->sid ) return;
+
+	uint32_t pids[MAX_PID / 32] = { 0 };
+
+	ts_bitmap_set ( pids, 0 );
+	ts_bitmap_set ( pids, dmx_rp->pmt->pid );
+
+	uint16_t pcr_pid = (uint16_t)( ( ( sec[8] & 0x1F ) << 8 ) | sec[9] );
+
+	// 0x1FFF: no PCR
+	if ( pcr_pid < MAX_PID - 1 ) ts_bitmap_set ( pids, pcr_pid );
+
+	uint32_t i = 12 + ( ( ( sec[10] & 0x0F ) << 8 ) | sec[11] ), n_es = 0;
+
+	while ( i + 5 <= len - 4 )
+	{
+		const uint8_t *p = sec + i;
+
+		ts_bitmap_set ( pids, (uint16_t)( ( ( p[1] & 0x1F ) << 8 ) | p[2] ) );
+
+		i += 5 + ( ( ( p[3] & 0x0F ) << 8 ) | p[4] );
+		n_es++;
+	}
+
+	g_debug ( "%s:: sid %u, PMT pid %u, version %u: %u streams", __func__, dmx_rp->monitor->sid, dmx_rp->pmt->pid, ( sec[5] >> 1 ) & 0x1F, n_es );
+
+	dmx_rec_prw_set_pids ( dmx_rp, pids );
+}
+
+static void dmx_rec_prw_psi ( uint16_t pid, const uint8_t *sec, uint32_t len, gpointer data )
+{
+	DmxRecPrw *dmx_rp = (DmxRecPrw *)data;
+
+	if ( pid == 0 && sec[0] == 0x00 ) dmx_rec_prw_pat ( dmx_rp, sec, len );
+
+	if ( pid == dmx_rp->pmt->pid && sec[0] == 0x02 ) dmx_rec_prw_pmt ( dmx_rp, sec, len );
+}
+
+// Before the copy: a new PID set applies from the next read
+static void dmx_rec_prw_route_psi ( DmxRecPrw *dmx_rp, const uint8_t *pkt, uint32_t m, const uint16_t *pkt_pid, const uint16_t *index )
+{
+	uint32_t i = 0; for ( i = 0; i < m; i++ )
+	{
+		uint16_t pid = pkt_pid[index[i]];
+
+		if ( pid == 0 ) psi_push ( dmx_rp->pat, pkt + index[i] * TS_SIZE, dmx_rec_prw_psi, dmx_rp );
+
+		if ( pid == dmx_rp->pmt->pid ) psi_push ( dmx_rp->pmt, pkt + index[i] * TS_SIZE, dmx_rec_prw_psi, dmx_rp );
+	}
+}
+
+static void dmx_rec_prw_route ( DmxRecPrw *dmx_rp, const uint8_t *pkt, uint32_t n, const uint16_t *pkt_pid, uint16_t *index )
+{
+	uint32_t m = ts_route ( pkt_pid, n, dmx_rp->pids, index );
+
+	if ( dmx_rp->pat ) dmx_rec_prw_route_psi ( dmx_rp, pkt, m, pkt_pid, index );
+
+	uint32_t i = 0; while ( i < m )
+	{
+		uint8_t *buf = ring_head ( dmx_rp->ring );
+
+		if ( !buf ) { dmx_rp->stats.ring_drop += ( m - i ) * TS_SIZE; break; }
+
+		uint32_t len = 0;
+
+		while ( i < m && len < BUF_SIZE )
+		{
+			// Copy a run of consecutive packets at once
+			uint32_t j = i + 1, max = i + ( BUF_SIZE - len ) / TS_SIZE;
+
+			while ( j < m && j < max && index[j] == index[j - 1] + 1 ) j++;
+
+			memcpy ( buf + len, pkt + index[i] * TS_SIZE, ( j - i ) * TS_SIZE );
+			ts_check ( dmx_rp->check, buf + len, j - i );
+
+			len += ( j - i ) * TS_SIZE;
+			i = j;
+		}
+
+		// The last block goes out partly filled, the writer should not wait for the next read
+		ring_push ( dmx_rp->ring, len );
+		dmx_rp->stats.size_read += len;
+		dmx_rp->stats.packets += len / TS_SIZE;
+	}
+
+	dmx_rec_prw_stats ( dmx_rp, m * TS_SIZE );
+}
+
+static void dmx_source_route ( DmxSource *src, const uint8_t *pkt, uint32_t n )
+{
+	GSList *l = NULL; for ( l = src->sinks; l; l = l->next ) dmx_rec_prw_route ( (DmxRecPrw *)l->data, pkt, n, src->pkt_pid, src->pkt_index );
+}
+
+static void dmx_source_read ( DmxSource *src, uint8_t *scratch )
+{
+	if ( src->fd == -1 ) return;
+
+	if ( !src->shared && src->sinks ) { dmx_rec_prw_read ( (DmxRecPrw *)src->sinks->data, scratch ); return; }
+
+	uint8_t *buf = ( src->shared ) ? src->buf : scratch;
+
+	ssize_t r = read ( src->fd, buf + src->carry, ( ( src->shared ) ? src->read_size : BUF_SIZE ) - src->carry );
+
+	if ( r == -1 && errno == EOVERFLOW ) { dmx_source_overflow ( src ); return; }
+
+	if ( r <= 0 )
+	{
+		if ( r == -1 ) perror ( "Read dmx_fd" );
+
+		if ( r == -1 && ( errno == EAGAIN || errno == EINTR ) ) return;
+
+		g_mutex_lock ( &sources_lock );
+		dmx_source_close_locked ( src );
+		g_mutex_unlock ( &sources_lock );
+
+		return;
+	}
+
+	// The capture is not handed over yet
+	if ( !src->shared ) return;
+
+	dmx_source_stats ( src, r, ( (uint32_t)r < src->read_size - src->carry ) );
+
+	uint32_t len = src->carry + (uint32_t)r;
+	uint32_t off = ts_sync ( buf, len );
+
+	while ( len - off >= TS_SIZE )
+	{
+		uint32_t n = ts_parse ( buf + off, ( len - off ) / TS_SIZE, src->pkt_pid );
+
+		if ( n ) dmx_source_route ( src, buf + off, n );
+
+		off += n * TS_SIZE;
+
+		// Lost sync: skip to the next packet boundary
+		if ( len - off >= TS_SIZE ) off += 1 + ts_sync ( buf + off + 1, len - off - 1 );
+	}
+
+	src->carry = len - off;
+	if ( src->carry ) memmove ( buf, buf + off, src->carry );
+
+	if ( src->sinks ) dmx_rec_prw_wakeup ( writer->event_fd );
+}
+
+static void dmx_source_detach ( DmxRecPrw *dmx_rp )
+{
+	DmxSource *src = dmx_rp->source;
+
+	src->sinks = g_slist_remove ( src->sinks, dmx_rp );
+
+	g_mutex_lock ( &sources_lock );
+
+	uint16_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ )
+	{
+		if ( !ts_bitmap_test ( dmx_rp->pids, pid ) ) continue;
+
+		if ( --src->pid_ref[pid] == 0 && src->fd != -1 && dmx_source_filter ( src ) && ioctl ( src->fd, DMX_REMOVE_PID, &pid ) == -1 ) perror ( "DMX_REMOVE_PID" );
+	}
+
+	gboolean last = ( --src->n_sinks == 0 );
+
+	if ( last )
+	{
+		sources = g_slist_remove ( sources, src );
+		dmx_source_close_locked ( src );
+	}
+
+	g_mutex_unlock ( &sources_lock );
+
+	if ( last )
+	{
+		if ( src->replay ) replay_free ( src->replay );
+
+		free ( src->name );
+		free ( src->buf );
+		free ( src );
+	}
+
+	dmx_rp->source = NULL;
+}
+
+static void dmx_source_start_replay ( void )
+{
+	g_mutex_lock ( &sources_lock );
+
+	GSList *l = NULL; for ( l = sources; l; l = l->next )
+	{
+		DmxSource *s = (DmxSource *)l->data;
+
+		if ( s->replay && !s->started ) { replay_start ( s->replay ); s->started = TRUE; }
+	}
+
+	g_mutex_unlock ( &sources_lock );
+}
+
+static void dmx_rec_prw_control ( Reactor *rc )
+{
+	uint64_t val = 0;
+	if ( read ( rc->event_fd, &val, sizeof(val) ) == -1 && errno != EAGAIN ) perror ( "Read event_fd" );
+
+	DmxRecPrw *dmx_rp = NULL;
+
+	while ( ( dmx_rp = g_async_queue_try_pop ( rc->queue ) ) )
+	{
+		clock_gettime ( CLOCK_MONOTONIC, &dmx_rp->mt1 );
+
+		dmx_rp->source->sinks = g_slist_prepend ( dmx_rp->source->sinks, dmx_rp );
+
+		rc->list = g_slist_prepend ( rc->list, dmx_rp );
+
+		g_async_queue_push ( writer->queue, dmx_rp );
+	}
+
+	// Only now every capture queued before the start is attached
+	if ( g_atomic_int_compare_and_exchange ( &replay_start_all, 1, 0 ) ) dmx_source_start_replay ();
+
+	GSList *l = rc->list;
+
+	while ( l )
+	{
+		GSList *next = l->next;
+		dmx_rp = (DmxRecPrw *)l->data;
+
+		if ( !g_atomic_int_get ( &dmx_rp->monitor->active ) )
+		{
+			rc->list = g_slist_delete_link ( rc->list, l );
+			dmx_source_detach ( dmx_rp );
+
+			// The writer drains what is left in the ring and frees the capture
+			g_atomic_int_set ( &dmx_rp->eof, 1 );
+		}
+
+		l = next;
+	}
+
+	dmx_rec_prw_wakeup ( writer->event_fd );
+}
+
+static gpointer dmx_rec_prw_reactor ( Reactor *rc )
+{
+	struct epoll_event events[MAX_EVENTS];
+
+	while ( TRUE )
+	{
+		int n = epoll_wait ( rc->epoll_fd, events, MAX_EVENTS, -1 );
+
+		if ( n == -1 )
+		{
+			if ( errno == EINTR ) continue;
+
+			perror ( "Reactor epoll_wait" );
+
+			break;
+		}
+
+		gboolean control = FALSE;
+
+		int i = 0; for ( i = 0; i < n; i++ )
+		{
+			if ( events[i].data.ptr == NULL ) { control = TRUE; continue; }
+
+			dmx_source_read ( (DmxSource *)events[i].data.ptr, rc->buf );
+		}
+
+		// Captures are only handed off here, after every pending event of this batch
+		if ( control ) dmx_rec_prw_control ( rc );
+	}
+
+	return NULL;
+}
+
+static gboolean dmx_rec_prw_init ( void )
+{
+	static gsize init = 0;
+
+	if ( g_once_init_enter ( &init ) )
+	{
+		Reactor *rc = g_new0 ( Reactor, 1 );
+		Writer  *wr = g_new0 ( Writer,  1 );
+
+		rc->epoll_fd = epoll_create1 ( EPOLL_CLOEXEC );
+		rc->event_fd = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+		rc->queue = g_async_queue_new ();
+
+		wr->epoll_fd = epoll_create1 ( EPOLL_CLOEXEC );
+		wr->event_fd = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+		wr->queue = g_async_queue_new ();
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+
+		if ( rc->epoll_fd == -1 || rc->event_fd == -1 || wr->epoll_fd == -1 || wr->event_fd == -1
+			|| epoll_ctl ( rc->epoll_fd, EPOLL_CTL_ADD, rc->event_fd, &ev ) == -1 || epoll_ctl ( wr->epoll_fd, EPOLL_CTL_ADD, wr->event_fd, &ev ) == -1 )
+		{
+			perror ( "Reactor init" );
+
+			if ( rc->epoll_fd != -1 ) close ( rc->epoll_fd );
+			if ( rc->event_fd != -1 ) close ( rc->event_fd );
+			if ( wr->epoll_fd != -1 ) close ( wr->epoll_fd );
+			if ( wr->event_fd != -1 ) close ( wr->event_fd );
+
+			g_async_queue_unref ( rc->queue );
+			g_async_queue_unref ( wr->queue );
+			free ( rc );
+			free ( wr );
+		}
+		else
+		{
+			reactor = rc;
+			writer  = wr;
+
+			GThread *thread = g_thread_new ( "rec-prw-writer", (GThreadFunc)dmx_rec_prw_writer, wr );
+			g_thread_unref ( thread );
+
+			thread = g_thread_new ( "rec-prw-reactor", (GThreadFunc)dmx_rec_prw_reactor, rc );
+			g_thread_unref ( thread );
+		}
+
+		g_once_init_leave ( &init, 1 );
+	}
+
+	return ( reactor ) ? TRUE : FALSE;
+}
+
+static void dmx_rec_prw_pipe ( DmxRecPrw *dmx_rp, uint32_t ring_size )
+{
+	if ( pipe2 ( dmx_rp->pipe_fd, O_NONBLOCK | O_CLOEXEC ) == -1 )
+	{
+		perror ( "Cannot create splice pipe" );
+
+		dmx_rp->pipe_fd[0] = -1;
+		dmx_rp->pipe_fd[1] = -1;
+
+		return;
+	}
+
+	// Unprivileged users are limited by /proc/sys/fs/pipe-max-size
+	int size = (int)MIN ( ring_size * 1024 * 1024, 64 * 1024 * 1024 );
+
+	while ( size > 65536 && fcntl ( dmx_rp->pipe_fd[1], F_SETPIPE_SZ, size ) == -1 ) size /= 2;
+
+	dmx_rp->pipe_size = (uint32_t)fcntl ( dmx_rp->pipe_fd[1], F_GETPIPE_SZ );
+	dmx_rp->splice = 1;
+}
+
+static int dmx_source_open ( uint8_t a, uint8_t d, uint16_t pid, const char **error )
+{
+	struct dmx_pes_filter_params f;
+
+	char dmxdev[PATH_MAX];
+	sprintf ( dmxdev, "/dev/dvb/adapter%i/demux%i", a, d );
+
+	int dmx_fd = open ( dmxdev, O_RDWR | O_NONBLOCK );
+
+	if ( dmx_fd == -1 )
+	{
+		perror ( "Cannot open dmx device" );
+		*error = "Cannot open dmx device";
+
+		return -1;
+	}
+
+	memset(&f, 0, sizeof(f));
+	f.pid = pid;
+	f.input = DMX_IN_FRONTEND;
+	f.output = DMX_OUT_TSDEMUX_TAP;
+	f.pes_type = DMX_PES_OTHER;
+
+	if ( ioctl ( dmx_fd, DMX_SET_BUFFER_SIZE, BUF_SIZE ) != 0 ) perror ( "DMX_SET_BUFFER_SIZE" );
+
+	if ( ioctl ( dmx_fd, DMX_SET_PES_FILTER, &f ) == -1 )
+	{
+		perror ( "DMX_SET_PES_FILTER" );
+		close ( dmx_fd );
+		*error = "Eroor: DMX_SET_PES_FILTER";
+
+		return -1;
+	}
+
+	if ( ioctl ( dmx_fd, DMX_START ) == -1 )
+	{
+		perror ( "DMX_START" );
+		close ( dmx_fd );
+		*error = "Eroor: DMX_START";
+
+		return -1;
+	}
+
+	return dmx_fd;
+}
+
+static DmxSource * dmx_source_new ( int fd, uint8_t a, uint8_t d, gboolean shared, gboolean dvr, const char **error )
+{
+	DmxSource *src = g_new0 ( DmxSource, 1 );
+
+	src->fd = fd;
+	src->adapter = a;
+	src->demux = d;
+	src->shared = shared;
+	src->dvr = dvr;
+	src->dmx_size = ( dvr ) ? DVR_BUF_SIZE : BUF_SIZE;
+	src->read_size = BUF_SIZE;
+
+	clock_gettime ( CLOCK_MONOTONIC, &src->mt1 );
+
+	if ( shared ) src->buf = g_malloc ( READ_MAX );
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.ptr = src;
+
+	if ( epoll_ctl ( reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+	{
+		perror ( "EPOLL_CTL_ADD" );
+		*error = "Cannot add device to capture reactor";
+
+		free ( src->buf );
+		free ( src );
+
+		return NULL;
+	}
+
+	return src;
+}
+
+// fd != -1: the capture owns the device ( dvr, splice ); else the dmx tap of a:d is shared
+static const char * dmx_source_attach ( DmxRecPrw *dmx_rp, uint8_t a, uint8_t d, int fd, uint16_t base )
+{
+	const char *ret = NULL;
+	gboolean shared = ( fd == -1 && dmx_rp->monitor->writer != REC_WRITER_SPLICE );
+
+	g_mutex_lock ( &sources_lock );
+
+	DmxSource *src = NULL;
+
+	GSList *l = NULL; for ( l = sources; shared && l; l = l->next )
+	{
+		DmxSource *s = (DmxSource *)l->data;
+
+		if ( s->fd != -1 && !s->replay && s->adapter == a && s->demux == d ) { src = s; break; }
+	}
+
+	if ( !src )
+	{
+		int new_fd = ( fd == -1 ) ? dmx_source_open ( a, d, base, &ret ) : fd;
+
+		if ( new_fd != -1 ) src = dmx_source_new ( new_fd, a, d, shared, ( fd != -1 ), &ret );
+
+		if ( src )
+		{
+			// The filter pid stays until the device is closed
+			if ( fd == -1 ) src->pid_ref[base]++;
+
+			if ( shared ) sources = g_slist_prepend ( sources, src );
+		}
+		else if ( new_fd != -1 && fd == -1 )
+			close ( new_fd );
+	}
+
+	if ( src )
+	{
+		uint16_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ )
+		{
+			if ( !ts_bitmap_test ( dmx_rp->pids, pid ) ) continue;
+
+			if ( src->pid_ref[pid]++ == 0 && dmx_source_filter ( src ) && ioctl ( src->fd, DMX_ADD_PID, &pid ) == -1 ) perror ( "DMX_ADD_PID" );
+		}
+
+		src->n_sinks++;
+		dmx_rp->source = src;
+	}
+
+	g_mutex_unlock ( &sources_lock );
+
+	return ret;
+}
+
+// Every capture of a replay that has not started yet shares it
+static const char * dmx_source_attach_replay ( DmxRecPrw *dmx_rp, const char *file, gboolean pace, uint32_t loops )
+{
+	const char *ret = NULL;
+
+	g_mutex_lock ( &sources_lock );
+
+	DmxSource *src = NULL;
+
+	GSList *l = NULL; for ( l = sources; l; l = l->next )
+	{
+		DmxSource *s = (DmxSource *)l->data;
+
+		if ( s->fd != -1 && s->replay && !s->started && g_str_equal ( s->name, file ) ) { src = s; break; }
+	}
+
+	if ( !src )
+	{
+		int fd = -1;
+		Replay *replay = replay_new ( file, pace, loops, &fd, &ret );
+
+		if ( replay ) src = dmx_source_new ( fd, 0, 0, TRUE, FALSE, &ret );
+
+		if ( src )
+		{
+			src->replay = replay;
+			src->name = g_strdup ( file );
+
+			sources = g_slist_prepend ( sources, src );
+		}
+		else if ( replay )
+		{
+			close ( fd );
+			replay_free ( replay );
+		}
+	}
+
+	if ( src )
+	{
+		uint16_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ ) if ( ts_bitmap_test ( dmx_rp->pids, pid ) ) src->pid_ref[pid]++;
+
+		src->n_sinks++;
+		dmx_rp->source = src;
+	}
+
+	g_mutex_unlock ( &sources_lock );
+
+	return ret;
+}
+
+static DmxRecPrw * dmx_rec_prw_new ( int frp_fd, uint8_t len_pid, uint16_t pids[], Monitor *monitor )
+{
+	uint32_t ring_size = ( monitor->ring_size ) ? monitor->ring_size : RING_SIZE;
+
+	Ring *ring = ring_new ( ring_size * 1024 * 1024 / BUF_SIZE, BUF_SIZE );
+
+	if ( !ring ) return NULL;
+
+	DmxRecPrw *dmx_rp = g_new0 ( DmxRecPrw, 1 );
+
+	dmx_rp->frp_fd = frp_fd;
+	dmx_rp->ring = ring;
+	dmx_rp->check = ts_check_new ();
+	dmx_rp->monitor = monitor_ref ( monitor );
+
+	dmx_rp->pipe_fd[0] = -1;
+	dmx_rp->pipe_fd[1] = -1;
+
+	// No PID list: the whole stream
+	if ( !len_pid ) memset ( dmx_rp->pids, 0xFF, sizeof ( dmx_rp->pids ) );
+
+	uint8_t i = 0; for ( i = 0; i < len_pid; i++ )
+	{
+		if ( pids[i] == 0 || pids[i] >= MAX_PID ) continue;
+
+		ts_bitmap_set ( dmx_rp->pids, pids[i] );
+	}
+
+	// The channel PIDs until the first PMT
+	if ( monitor->sid )
+	{
+		dmx_rp->pat = g_new ( Psi, 1 );
+		dmx_rp->pmt = g_new ( Psi, 1 );
+
+		psi_init ( dmx_rp->pat, 0 );
+		psi_init ( dmx_rp->pmt, MAX_PID );
+
+		ts_bitmap_set ( dmx_rp->pids, 0 );
+	}
+
+	return dmx_rp;
+}
+
+static void dmx_rec_prw_discard ( DmxRecPrw *dmx_rp )
+{
+	ring_free ( dmx_rp->ring );
+
+	monitor_unref ( dmx_rp->monitor );
+	free ( dmx_rp->check );
+	free ( dmx_rp->pat );
+	free ( dmx_rp->pmt );
+	free ( dmx_rp );
+}
+
+static void dmx_rec_prw_queue ( DmxRecPrw *dmx_rp, const char *fifo, Stream *stream, Rtp *net )
+{
+	uint32_t ring_size = ( dmx_rp->monitor->ring_size ) ? dmx_rp->monitor->ring_size : RING_SIZE;
+
+	dmx_rp->fifo = ( fifo ) ? g_strdup ( fifo ) : NULL;
+	dmx_rp->stream = stream;
+	dmx_rp->net = net;
+
+	if ( dmx_rp->monitor->writer == REC_WRITER_SPLICE && !dmx_rp->source->shared ) dmx_rec_prw_pipe ( dmx_rp, ring_size );
+
+	g_async_queue_push ( reactor->queue, dmx_rp );
+
+	dmx_rec_prw_wakeup ( reactor->event_fd );
+}
+
+static const char * dmx_rec_prw_add ( uint8_t a, uint8_t d, int dvr_fd, int frp_fd, const char *fifo, Stream *stream, Rtp *net, uint8_t len_pid, uint16_t pids[], uint16_t base, Monitor *monitor )
+{
+	DmxRecPrw *dmx_rp = dmx_rec_prw_new ( frp_fd, len_pid, pids, monitor );
+
+	if ( !dmx_rp ) return "Cannot allocate ring buffer";
+
+	// The PAT and the PMT are read from the shared tap: no splice pipe
+	if ( monitor->sid && monitor->writer == REC_WRITER_SPLICE ) monitor->writer = REC_WRITER_WRITE;
+
+	if ( dvr_fd == -1 ) ts_bitmap_set ( dmx_rp->pids, base );
+
+	const char *ret = dmx_source_attach ( dmx_rp, a, d, dvr_fd, base );
+
+	if ( ret ) { dmx_rec_prw_discard ( dmx_rp ); return ret; }
+
+	dmx_rec_prw_queue ( dmx_rp, fifo, stream, net );
+
+	return NULL;
+}
+
+void dmx_rec_prw_stop ( Monitor *monitor )
+{
+	g_atomic_int_set ( &monitor->active, 0 );
+
+	if ( reactor ) dmx_rec_prw_wakeup ( reactor->event_fd );
+}
+
+const char * dmx_prw_create ( uint8_t a, uint8_t d, const char *prw, uint8_t len_pid, uint16_t pids[], Monitor *monitor, const char *player )
+{
+	if ( !dmx_rec_prw_init () ) return "Cannot start capture reactor";
+
+	if ( mkfifo ( prw, S_IRUSR | S_IWUSR ) < 0 )
+	{
+		perror ( "Cannot create FIFO" );
+
+		return "Cannot create FIFO";
+	}
+
+	// O_RDWR: the open does not wait for the player. O_NONBLOCK: a full FIFO is a drop, not a stall
+	int prw_fd = open ( prw, O_RDWR | O_NONBLOCK );
+
+	if ( prw_fd == -1 )
+	{
+		perror ( "Cannot open FIFO" );
+		remove ( prw );
+
+		return "Cannot open FIFO";
+	}
+
+	const char *ret = dmx_rec_prw_add ( a, d, -1, prw_fd, prw, NULL, NULL, len_pid, pids, pids[0], monitor );
+
+	if ( ret )
+	{
+		close ( prw_fd );
+		remove ( prw );
+
+		return ret;
+	}
+
+	GError *error = NULL;
+
+	if ( !player_start ( player, prw, &error ) ) { g_warning ( "%s: %s", __func__, error->message ); g_error_free ( error ); }
+
+	return NULL;
+}
+
+static Stream * dmx_stream_new ( const char *path, Monitor *monitor, const char **error )
+{
+	if ( !stream_server_start ( ( monitor->stream_port ) ? monitor->stream_port : STREAM_PORT, error ) ) return NULL;
+
+	// The clients read from the shared tap: no splice pipe of its own
+	monitor->writer = REC_WRITER_WRITE;
+
+	return stream_new ( path, error );
+}
+
+const char * dmx_stream_create ( uint8_t a, uint8_t d, const char *path, uint8_t len_pid, uint16_t pids[], Monitor *monitor, const char *player )
+{
+	if ( !dmx_rec_prw_init () ) return "Cannot start capture reactor";
+
+	const char *ret = NULL;
+	Stream *stream = dmx_stream_new ( path, monitor, &ret );
+
+	if ( !stream ) return ret;
+
+	// The writer owns the stream once queued
+	g_autofree char *uri = g_strdup ( stream_uri ( stream ) );
+
+	ret = dmx_rec_prw_add ( a, d, -1, -1, NULL, stream, NULL, len_pid, pids, pids[0], monitor );
+
+	if ( ret ) { stream_free ( stream ); return ret; }
+
+	GError *error = NULL;
+
+	if ( player && !player_start ( player, uri, &error ) ) { g_warning ( "%s: %s", __func__, error->message ); g_error_free ( error ); }
+
+	return NULL;
+}
+
+// rec: a file, or udp://host:port rtp://host:port ( unicast or multicast )
+static int dmx_rec_open ( const char *rec, Monitor *monitor, Rtp **net, const char **error )
+{
+	int rec_fd = -1;
+
+	if ( rtp_uri ( rec ) )
+	{
+		*net = rtp_open ( rec, monitor->net_ttl, monitor->net_pace, &rec_fd, error );
+
+		// Datagrams are cut from the ring blocks: no splice pipe, no file writer
+		if ( *net ) monitor->writer = REC_WRITER_WRITE;
+
+		return rec_fd;
+	}
+
+	rec_fd = open ( rec, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0664 );
+
+	if ( rec_fd == -1 ) { perror ( "Cannot open rec file" ); *error = "Cannot open rec file"; }
+
+	return rec_fd;
+}
+
+static void dmx_rec_close ( int rec_fd, Rtp *net )
+{
+	close ( rec_fd );
+
+	if ( net ) rtp_free ( net );
+}
+
+const char * dmx_rec_create ( uint8_t a, uint8_t d, const char *rec, uint8_t len_pid, uint16_t pids[], Monitor *monitor )
+{
+	if ( !dmx_rec_prw_init () ) return "Cannot start capture reactor";
+
+	Rtp *net = NULL;
+	const char *ret = NULL;
+	int rec_fd = dmx_rec_open ( rec, monitor, &net, &ret );
+
+	if ( rec_fd == -1 ) return ret;
+
+	ret = dmx_rec_prw_add ( a, d, -1, rec_fd, NULL, NULL, net, len_pid, pids, 0, monitor );
+
+	if ( ret ) dmx_rec_close ( rec_fd, net );
+
+	return ret;
+}
+
+const char * dvr_rec_create ( const char *dvr, const char *rec, Monitor *monitor )
+{
+	if ( !dmx_rec_prw_init () ) return "Cannot start capture reactor";
+
+	int dvr_fd = open ( dvr, O_RDONLY | O_NONBLOCK );
+
+	if ( dvr_fd == -1 )
+	{
+		perror ( "Cannot open dvr device" );
+
+		return "Cannot open dvr device";
+	}
+
+	Rtp *net = NULL;
+	const char *ret = NULL;
+	int rec_fd = dmx_rec_open ( rec, monitor, &net, &ret );
+
+	if ( rec_fd == -1 ) { close ( dvr_fd ); return ret; }
+
+	ret = dmx_rec_prw_add ( 0, 0, dvr_fd, rec_fd, NULL, NULL, net, 0, NULL, 0, monitor );
+
+	if ( ret ) { dmx_rec_close ( rec_fd, net ); close ( dvr_fd ); }
+
+	return ret;
+}
+
+const char * replay_rec_create ( const char *ts, gboolean pace, uint32_t loops, const char *rec, uint8_t len_pid, uint16_t pids[], Monitor *monitor )
+{
+	if ( !dmx_rec_prw_init () ) return "Cannot start capture reactor";
+
+	Rtp *net = NULL;
+	const char *ret = NULL;
+	int rec_fd = dmx_rec_open ( rec, monitor, &net, &ret );
+
+	if ( rec_fd == -1 ) return ret;
+
+	DmxRecPrw *dmx_rp = dmx_rec_prw_new ( rec_fd, len_pid, pids, monitor );
+
+	if ( !dmx_rp ) { dmx_rec_close ( rec_fd, net ); return "Cannot allocate ring buffer"; }
+
+	ret = dmx_source_attach_replay ( dmx_rp, ts, pace, loops );
+
+	if ( ret ) { dmx_rec_prw_discard ( dmx_rp ); dmx_rec_close ( rec_fd, net ); return ret; }
+
+	dmx_rec_prw_queue ( dmx_rp, NULL, NULL, net );
+
+	return NULL;
+}
+
+const char * replay_stream_create ( const char *ts, gboolean pace, uint32_t loops, const char *path, uint8_t len_pid, uint16_t pids[], Monitor *monitor )
+{
+	if ( !dmx_rec_prw_init () ) return "Cannot start capture reactor";
+
+	const char *ret = NULL;
+	Stream *stream = dmx_stream_new ( path, monitor, &ret );
+
+	if ( !stream ) return ret;
+
+	DmxRecPrw *dmx_rp = dmx_rec_prw_new ( -1, len_pid, pids, monitor );
+
+	if ( !dmx_rp ) { stream_free ( stream ); return "Cannot allocate ring buffer"; }
+
+	ret = dmx_source_attach_replay ( dmx_rp, ts, pace, loops );
+
+	if ( ret ) { dmx_rec_prw_discard ( dmx_rp ); stream_free ( stream ); return ret; }
+
+	dmx_rec_prw_queue ( dmx_rp, NULL, stream, NULL );
+
+	return NULL;
+}
+
+void replay_rec_start ( void )
+{
+	if ( !reactor ) return;
+
+	g_atomic_int_set ( &replay_start_all, 1 );
+
+	dmx_rec_prw_wakeup ( reactor->event_fd );
 }
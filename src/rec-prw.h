@@ -11,21 +11,135 @@
 
 #include <gtk/gtk.h>
 
+enum rec_writer
+{
+	REC_WRITER_WRITE,
+	REC_WRITER_URING,
+	REC_WRITER_SPLICE,
+	REC_WRITER_PREALLOC,
+	REC_WRITER_DIRECT
+};
+
+// Preview FIFO when the player falls behind
+enum prw_drop
+{
+	PRW_DROP_OLDEST, // skip to the next random access point
+	PRW_DROP_NEWEST
+};
+
+#define MONITOR_PIDS   64
+#define MONITOR_CLOCKS 16 // TS_CLOCKS
+
 typedef struct _Monitor Monitor;
+typedef struct _MonitorStats MonitorStats;
+typedef struct _MonitorPids MonitorPids;
 
-struct _Monitor
+struct _MonitorStats
 {
-	uint8_t  column;
-	uint8_t  active;
-	uint32_t bitrate;
+	uint32_t bitrate;   // Kbps, wall clock
+	uint32_t pcr_bitrate;  // Kbps, timed by the PCR; 0: no PCR yet
+	uint32_t pcr_interval; // us, longest of the last second, every clock
+	uint32_t pcr_jitter;   // ns
+	uint64_t pcr_disc;
+	uint64_t size_read; // pushed to the ring
+	uint64_t packets;
 	uint64_t size_file;
 
-	uint16_t path;
-	GtkTreeView *treeview;
+	uint8_t  ring_hwm;  // %
+	uint64_t ring_drop;
+	uint64_t fifo_drop; // preview: FIFO drop oldest, stream clients; rec: udp:// rtp:// send errors
+	uint32_t clients;   // stream
+
+	uint32_t lat_p50;   // write ( ), us
+	uint32_t lat_p99;
+	uint32_t lat_max;
+
+	uint32_t dmx_size;  // KB
+	uint64_t dmx_overflow;
+
+	uint64_t cc_error;
+	uint64_t tei_error;
+	uint64_t scrambled;
+};
+
+typedef struct _MonitorPid MonitorPid;
+typedef struct _MonitorClock MonitorClock;
+
+struct _MonitorPid
+{
+	uint16_t pid;
+	uint32_t bitrate;  // Kbps
+	uint32_t cc_error;
+};
+
+struct _MonitorClock
+{
+	uint16_t pid;
+	uint32_t interval; // us
+	uint32_t jitter;   // ns
+	uint32_t disc;
+};
+
+// The PIDs of the last PCR second, by PID ( up to MONITOR_PIDS ), and the clocks; published once a second
+struct _MonitorPids
+{
+	uint32_t n_pid;
+	uint32_t n_clock;
+	MonitorPid pid[MONITOR_PIDS];
+	MonitorClock clock[MONITOR_CLOCKS];
+};
+
+struct _Monitor
+{
+	int      ref;
+	int      active;
+	int      eof;       // the source has ended ( replay )
+
+	uint8_t  writer;    // enum rec_writer
+	uint16_t ring_size; // MB
+	uint8_t  prw_drop;  // enum prw_drop
+	uint16_t stream_port; // 0: STREAM_PORT
+	uint8_t  net_ttl;   // udp:// rtp://, 0: 1
+	uint8_t  net_pace;  // kernel pacing of the datagrams
+	uint16_t sid;       // != 0: the PIDs follow the PMT of this program, every stream and the PCR
+
+	// Reactor and writer thread publish under their own sequence counter: read with monitor_stats ( )
+	int seq_read;
+	int seq_write;
+	MonitorStats read;
+	MonitorStats write; // size_file, fifo_drop, clients, lat_*
+
+	int seq_pids;
+	MonitorPids pids;
 };
 
+// ref 1; the capture holds its own reference while it runs
+Monitor * monitor_new ( void );
+
+Monitor * monitor_ref ( Monitor * );
+
+void monitor_unref ( Monitor * );
+
+// Consistent snapshot from any thread, at any rate; never blocks the capture
+void monitor_stats ( Monitor *, MonitorStats * );
+
+void monitor_pids ( Monitor *, MonitorPids * );
+
+// rec: a file, or udp://host:port rtp://host:port ( sent as datagrams of 7 packets )
 const char * dvr_rec_create ( const char *, const char *, Monitor * );
 
 const char * dmx_rec_create ( uint8_t , uint8_t , const char *, uint8_t , uint16_t *, Monitor * );
 
 const char * dmx_prw_create ( uint8_t , uint8_t , const char *, uint8_t , uint16_t *, Monitor *, const char * );
+
+// Preview through the loopback stream server; the player gets the uri, and any other client can join
+const char * dmx_stream_create ( uint8_t , uint8_t , const char *, uint8_t , uint16_t *, Monitor *, const char * );
+
+const char * replay_rec_create ( const char *, gboolean , uint32_t , const char *, uint8_t , uint16_t *, Monitor * );
+
+const char * replay_stream_create ( const char *, gboolean , uint32_t , const char *, uint8_t , uint16_t *, Monitor * );
+
+// Starts the replays of every capture created so far
+void replay_rec_start ( void );
+
+void dmx_rec_prw_stop ( Monitor * );
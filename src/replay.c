@@ -0,0 +1,266 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#define _GNU_SOURCE
+
+#include "ts.h"
+#include "ts-gen.h"
+#include "replay.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define REPLAY_CHUNK ( 512 * TS_SIZE )
+#define PIPE_SIZE    ( 1024 * 1024 )
+#define PCR_JUMP     ( 10 * (int64_t)TS_PCR_HZ )
+
+struct _Replay
+{
+	int in_fd;
+	int out_fd;
+
+	TsGen *gen;
+	uint32_t gen_left; // packets of this loop
+
+	gboolean pace;
+	uint32_t loops;
+
+	int stop;
+	gboolean run;
+
+	GMutex lock;
+	GCond  cond;
+
+	GThread *thread;
+};
+
+static gboolean replay_write ( Replay *rp, const uint8_t *buf, uint32_t len )
+{
+	while ( len && !g_atomic_int_get ( &rp->stop ) )
+	{
+		ssize_t w = write ( rp->out_fd, buf, len );
+
+		if ( w == -1 )
+		{
+			if ( errno == EINTR ) continue;
+			if ( errno != EPIPE ) perror ( "Replay write" );
+
+			return FALSE;
+		}
+
+		buf += w;
+		len -= (uint32_t)w;
+	}
+
+	return ( len == 0 );
+}
+
+static ssize_t replay_read ( Replay *rp, uint8_t *buf, uint32_t len )
+{
+	if ( !rp->gen ) return read ( rp->in_fd, buf, len );
+
+	uint32_t n = MIN ( len / TS_SIZE, rp->gen_left );
+
+	ts_gen_fill ( rp->gen, buf, n );
+	rp->gen_left -= n;
+
+	return n * TS_SIZE;
+}
+
+// One loop of the generator is one second of the stream
+static gboolean replay_rewind ( Replay *rp )
+{
+	if ( rp->gen ) { rp->gen_left = ts_gen_rate ( rp->gen ); return TRUE; }
+
+	return ( lseek ( rp->in_fd, 0, SEEK_SET ) != -1 );
+}
+
+static void replay_sleep_until ( Replay *rp, int64_t t )
+{
+	int64_t now = 0;
+
+	// In steps, so a stop is seen quickly
+	while ( !g_atomic_int_get ( &rp->stop ) && ( now = g_get_monotonic_time () ) < t ) g_usleep ( (gulong)MIN ( t - now, 100000 ) );
+}
+
+static gpointer replay_thread ( Replay *rp )
+{
+	// SIGPIPE is sent to the writing thread: keep it pending here, write ( ) returns EPIPE
+	sigset_t set;
+	sigemptyset ( &set );
+	sigaddset ( &set, SIGPIPE );
+	pthread_sigmask ( SIG_BLOCK, &set, NULL );
+
+	g_mutex_lock ( &rp->lock );
+	while ( !rp->run && !g_atomic_int_get ( &rp->stop ) ) g_cond_wait ( &rp->cond, &rp->lock );
+	g_mutex_unlock ( &rp->lock );
+
+	uint8_t *buf = g_malloc ( REPLAY_CHUNK );
+
+	uint32_t loop = 0, carry = 0;
+	uint16_t pcr_pid = MAX_PID;
+	int64_t pcr0 = -1, t0 = 0;
+
+	while ( !g_atomic_int_get ( &rp->stop ) )
+	{
+		ssize_t r = replay_read ( rp, buf + carry, REPLAY_CHUNK - carry );
+
+		if ( r == -1 && errno == EINTR ) continue;
+
+		if ( r == -1 ) { perror ( "Replay read" ); break; }
+
+		if ( r == 0 )
+		{
+			if ( ++loop >= rp->loops || !replay_rewind ( rp ) ) break;
+
+			// The clock starts over with the file
+			carry = 0;
+			pcr0 = -1;
+
+			continue;
+		}
+
+		uint32_t len = carry + (uint32_t)r;
+
+		if ( !rp->pace )
+		{
+			if ( !replay_write ( rp, buf, len ) ) break;
+
+			continue;
+		}
+
+		uint32_t off = ts_sync ( buf, len ), start = 0;
+
+		for ( ; off + TS_SIZE <= len; off += TS_SIZE )
+		{
+			const uint8_t *p = buf + off;
+
+			if ( p[0] != TS_SYNC ) continue;
+
+			uint16_t pid = (uint16_t)( ( ( p[1] & 0x1F ) << 8 ) | p[2] );
+
+			if ( pcr_pid != MAX_PID && pid != pcr_pid ) continue;
+
+			int64_t pcr = ts_pcr ( p );
+
+			if ( pcr == -1 ) continue;
+
+			pcr_pid = pid;
+
+			if ( pcr0 == -1 || pcr < pcr0 || pcr - pcr0 > PCR_JUMP + ( g_get_monotonic_time () - t0 ) * ( TS_PCR_HZ / 1000000 ) )
+			{
+				// First PCR, wrap or discontinuity
+				pcr0 = pcr;
+				t0 = g_get_monotonic_time ();
+
+				continue;
+			}
+
+			// Everything before this packet is due now
+			if ( !replay_write ( rp, buf + start, off - start ) ) { g_atomic_int_set ( &rp->stop, 1 ); break; }
+
+			start = off;
+
+			replay_sleep_until ( rp, t0 + ( pcr - pcr0 ) / ( TS_PCR_HZ / 1000000 ) );
+		}
+
+		if ( !replay_write ( rp, buf + start, off - start ) ) break;
+
+		carry = len - off;
+		if ( carry ) memmove ( buf, buf + off, carry );
+	}
+
+	free ( buf );
+
+	// EOF for the reactor
+	close ( rp->out_fd );
+	rp->out_fd = -1;
+
+	return NULL;
+}
+
+Replay * replay_new ( const char *file, gboolean pace, uint32_t loops, int *fd, const char **error )
+{
+	int in_fd = -1;
+	TsGen *gen = NULL;
+
+	if ( g_str_has_prefix ( file, REPLAY_GEN ) )
+	{
+		if ( !( gen = ts_gen_new ( file + strlen ( REPLAY_GEN ), error ) ) ) return NULL;
+	}
+	else if ( ( in_fd = open ( file, O_RDONLY | O_CLOEXEC ) ) == -1 )
+	{
+		perror ( "Cannot open replay file" );
+		*error = "Cannot open replay file";
+
+		return NULL;
+	}
+
+	int pipe_fd[2];
+
+	if ( pipe2 ( pipe_fd, O_CLOEXEC ) == -1 )
+	{
+		perror ( "Cannot create replay pipe" );
+		if ( gen ) ts_gen_free ( gen ); else close ( in_fd );
+		*error = "Cannot create replay pipe";
+
+		return NULL;
+	}
+
+	if ( fcntl ( pipe_fd[1], F_SETPIPE_SZ, PIPE_SIZE ) == -1 ) perror ( "F_SETPIPE_SZ" );
+
+	fcntl ( pipe_fd[0], F_SETFL, O_NONBLOCK );
+
+	Replay *rp = g_new0 ( Replay, 1 );
+
+	rp->in_fd = in_fd;
+	rp->gen = gen;
+	rp->gen_left = ( gen ) ? ts_gen_rate ( gen ) : 0;
+	rp->out_fd = pipe_fd[1];
+	rp->pace = pace;
+	rp->loops = MAX ( loops, 1 );
+
+	g_mutex_init ( &rp->lock );
+	g_cond_init  ( &rp->cond );
+
+	rp->thread = g_thread_new ( "rec-prw-replay", (GThreadFunc)replay_thread, rp );
+
+	*fd = pipe_fd[0];
+
+	return rp;
+}
+
+void replay_start ( Replay *rp )
+{
+	g_mutex_lock ( &rp->lock );
+	rp->run = TRUE;
+	g_cond_signal ( &rp->cond );
+	g_mutex_unlock ( &rp->lock );
+}
+
+void replay_free ( Replay *rp )
+{
+	g_mutex_lock ( &rp->lock );
+	g_atomic_int_set ( &rp->stop, 1 );
+	g_cond_signal ( &rp->cond );
+	g_mutex_unlock ( &rp->lock );
+
+	g_thread_join ( rp->thread );
+
+	if ( rp->gen ) ts_gen_free ( rp->gen ); else close ( rp->in_fd );
+
+	g_mutex_clear ( &rp->lock );
+	g_cond_clear  ( &rp->cond );
+
+	free ( rp );
+}
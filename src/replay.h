@@ -0,0 +1,30 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Feeds a recorded TS ( file or FIFO ) or a synthetic one into a pipe, at full speed or paced by PCR.
+ * epoll can not watch a regular file, the capture reactor reads the pipe like a demux.
+ */
+
+typedef struct _Replay Replay;
+
+// file: REPLAY_GEN "spec" replays the synthetic stream of ts-gen.h, one loop per second
+#define REPLAY_GEN "gen:"
+
+// *fd: non-blocking read end, owned by the caller
+Replay * replay_new ( const char *file, gboolean pace, uint32_t loops, int *fd, const char **error );
+
+void replay_start ( Replay * );
+
+// Close the read end first: a feeder blocked on a full pipe gets EPIPE
+void replay_free ( Replay * );
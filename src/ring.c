@@ -0,0 +1,116 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "ring.h"
+
+struct _Ring
+{
+	uint8_t  *data;
+	uint32_t *len;
+
+	uint32_t n_blocks;
+	uint32_t block_size;
+
+	uint32_t head; // written by the producer only
+	uint32_t tail; // written by the consumer only
+
+	uint32_t hwm;
+};
+
+Ring * ring_new ( uint32_t n_blocks, uint32_t block_size )
+{
+	if ( n_blocks < 2 ) n_blocks = 2;
+
+	Ring *ring = g_new0 ( Ring, 1 );
+
+	ring->data = g_try_malloc ( (gsize)n_blocks * block_size );
+	ring->len  = g_new0 ( uint32_t, n_blocks );
+
+	if ( !ring->data ) { free ( ring->len ); free ( ring ); return NULL; }
+
+	ring->n_blocks = n_blocks;
+	ring->block_size = block_size;
+
+	return ring;
+}
+
+void ring_free ( Ring *ring )
+{
+	free ( ring->data );
+	free ( ring->len  );
+	free ( ring );
+}
+
+uint8_t * ring_head ( Ring *ring )
+{
+	uint32_t tail = __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE );
+
+	if ( ring->head - tail >= ring->n_blocks ) return NULL;
+
+	return ring->data + (gsize)( ring->head % ring->n_blocks ) * ring->block_size;
+}
+
+void ring_push ( Ring *ring, uint32_t len )
+{
+	ring->len[ring->head % ring->n_blocks] = len;
+
+	__atomic_store_n ( &ring->head, ring->head + 1, __ATOMIC_RELEASE );
+
+	uint32_t fill = ring->head - __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE );
+
+	if ( fill > __atomic_load_n ( &ring->hwm, __ATOMIC_RELAXED ) ) __atomic_store_n ( &ring->hwm, fill, __ATOMIC_RELAXED );
+}
+
+uint8_t * ring_tail ( Ring *ring, uint32_t *len )
+{
+	uint32_t head = __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE );
+
+	if ( head == ring->tail ) return NULL;
+
+	*len = ring->len[ring->tail % ring->n_blocks];
+
+	return ring->data + (gsize)( ring->tail % ring->n_blocks ) * ring->block_size;
+}
+
+void ring_pop ( Ring *ring )
+{
+	__atomic_store_n ( &ring->tail, ring->tail + 1, __ATOMIC_RELEASE );
+}
+
+uint8_t * ring_peek ( Ring *ring, uint32_t nth, uint32_t *len, uint32_t *index )
+{
+	uint32_t head = __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE );
+
+	if ( head - ring->tail <= nth ) return NULL;
+
+	uint32_t i = ( ring->tail + nth ) % ring->n_blocks;
+
+	*len = ring->len[i];
+	*index = i;
+
+	return ring->data + (gsize)i * ring->block_size;
+}
+
+uint8_t * ring_data ( Ring *ring, uint32_t *n_blocks, uint32_t *block_size )
+{
+	*n_blocks = ring->n_blocks;
+	*block_size = ring->block_size;
+
+	return ring->data;
+}
+
+uint32_t ring_fill ( Ring *ring )
+{
+	return __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE ) - __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE );
+}
+
+uint8_t ring_hwm ( Ring *ring )
+{
+	return (uint8_t)( __atomic_load_n ( &ring->hwm, __ATOMIC_RELAXED ) * 100 / ring->n_blocks );
+}
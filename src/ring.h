@@ -0,0 +1,40 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Single-producer / single-consumer ring of fixed-size blocks.
+ * The producer fills ring_head () and publishes it with ring_push (),
+ * the consumer reads ring_tail () and releases it with ring_pop ().
+ */
+
+typedef struct _Ring Ring;
+
+Ring * ring_new ( uint32_t n_blocks, uint32_t block_size );
+
+void ring_free ( Ring * );
+
+uint8_t * ring_head ( Ring * );
+
+void ring_push ( Ring *, uint32_t len );
+
+uint8_t * ring_tail ( Ring *, uint32_t *len );
+
+void ring_pop ( Ring * );
+
+uint8_t * ring_peek ( Ring *, uint32_t nth, uint32_t *len, uint32_t *index );
+
+uint8_t * ring_data ( Ring *, uint32_t *n_blocks, uint32_t *block_size );
+
+uint32_t ring_fill ( Ring * );
+
+uint8_t ring_hwm ( Ring * );
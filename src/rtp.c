@@ -0,0 +1,323 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#define _GNU_SOURCE
+
+#include "ts.h"
+#include "rtp.h"
+
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#ifndef UDP_SEGMENT
+  #define UDP_SEGMENT 103
+#endif
+
+#define RTP_BATCH 64
+#define RTP_HDR   12
+#define RTP_MP2T  33
+#define RTP_DGRAM ( RTP_TS_PACKETS * TS_SIZE )
+
+#define GSO_BATCH 8  // super datagrams per sendmmsg ( )
+#define GSO_SEGS  48 // datagrams per super datagram, < 64 KB
+
+struct _Rtp
+{
+	gboolean rtp;
+	uint16_t seq;
+	uint32_t ssrc;
+
+	uint8_t hdr[RTP_BATCH][RTP_HDR];
+	struct iovec iov[RTP_BATCH][2];
+	struct mmsghdr msg[RTP_BATCH];
+
+	// UDP_SEGMENT: one send of up to GSO_SEGS datagrams, the kernel cuts them
+	gboolean gso;
+	uint8_t *stage; // RTP: header and payload of every segment, back to back
+	char cmsg[GSO_BATCH][CMSG_SPACE ( sizeof ( uint16_t ) )];
+
+	// SO_MAX_PACING_RATE follows the bitrate of the last second ( fq qdisc )
+	gboolean pace;
+	int pace_fd;
+	uint64_t pace_bytes;
+	struct timespec pace_t;
+};
+
+Rtp * rtp_new ( gboolean rtp )
+{
+	Rtp *r = g_new0 ( Rtp, 1 );
+
+	r->rtp  = rtp;
+	r->seq  = (uint16_t)g_random_int ();
+	r->ssrc = g_random_int ();
+
+	return r;
+}
+
+void rtp_free ( Rtp *r )
+{
+	free ( r->stage );
+	free ( r );
+}
+
+static uint32_t rtp_clock ( void )
+{
+	struct timespec ts;
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+	return (uint32_t)( (uint64_t)ts.tv_sec * 90000 + (uint64_t)ts.tv_nsec / 11111 ); // 90 kHz
+}
+
+static void rtp_header ( Rtp *r, uint8_t *hdr, uint16_t seq, uint32_t time )
+{
+	hdr[0] = 0x80; // V 2
+	hdr[1] = RTP_MP2T;
+	hdr[2] = (uint8_t)( seq >> 8 );
+	hdr[3] = (uint8_t)seq;
+
+	hdr[4] = (uint8_t)( time >> 24 ); hdr[5] = (uint8_t)( time >> 16 ); hdr[6]  = (uint8_t)( time >> 8 ); hdr[7]  = (uint8_t)time;
+	hdr[8] = (uint8_t)( r->ssrc >> 24 ); hdr[9] = (uint8_t)( r->ssrc >> 16 ); hdr[10] = (uint8_t)( r->ssrc >> 8 ); hdr[11] = (uint8_t)r->ssrc;
+}
+
+static void rtp_pace ( Rtp *r, uint32_t len )
+{
+	r->pace_bytes += len;
+
+	struct timespec t;
+	clock_gettime ( CLOCK_MONOTONIC, &t );
+
+	int64_t elapsed_ns = ( t.tv_sec - r->pace_t.tv_sec ) * 1000000000LL + ( t.tv_nsec - r->pace_t.tv_nsec );
+
+	if ( elapsed_ns < 1000000000LL ) return;
+
+	// Bytes per second, a quarter above the stream: the bursts of one read are spread, the stream is not slowed down
+	uint64_t bps = (uint64_t)( (double)r->pace_bytes * 1e9 / (double)elapsed_ns ) * 5 / 4;
+	uint32_t rate = (uint32_t)MIN ( MAX ( bps, 125000 ), G_MAXUINT32 );
+
+	if ( setsockopt ( r->pace_fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof ( rate ) ) == -1 ) { perror ( "SO_MAX_PACING_RATE" ); r->pace = FALSE; }
+
+	r->pace_bytes = 0;
+	r->pace_t = t;
+}
+
+// GSO_BATCH super datagrams per syscall; 0: the socket does not segment, nothing was sent; -1: error
+static int rtp_send_gso ( Rtp *r, int fd, const uint8_t *buf, uint32_t end, uint32_t *sent )
+{
+	uint32_t time = rtp_clock ();
+	uint32_t seg = RTP_DGRAM + ( ( r->rtp ) ? RTP_HDR : 0 );
+
+	while ( *sent < end )
+	{
+		uint32_t n = 0, off = *sent, dgrams = 0;
+
+		for ( n = 0; n < GSO_BATCH && off < end; n++ )
+		{
+			uint32_t size = MIN ( end - off, GSO_SEGS * RTP_DGRAM );
+			struct iovec *iov = r->iov[n];
+
+			if ( r->rtp )
+			{
+				uint8_t *st = r->stage + (gsize)n * GSO_SEGS * seg;
+				uint32_t k = 0, len = 0;
+
+				for ( k = 0; k * RTP_DGRAM < size; k++ )
+				{
+					uint32_t part = MIN ( size - k * RTP_DGRAM, RTP_DGRAM );
+
+					rtp_header ( r, st + len, (uint16_t)( r->seq + dgrams + k ), time );
+					memcpy ( st + len + RTP_HDR, buf + off + k * RTP_DGRAM, part );
+
+					len += RTP_HDR + part;
+				}
+
+				iov->iov_base = st;
+				iov->iov_len = len;
+				dgrams += k;
+			}
+			else
+			{
+				iov->iov_base = (void *)( buf + off );
+				iov->iov_len = size;
+				dgrams += ( size + RTP_DGRAM - 1 ) / RTP_DGRAM;
+			}
+
+			memset ( &r->msg[n], 0, sizeof ( struct mmsghdr ) );
+			r->msg[n].msg_hdr.msg_iov = iov;
+			r->msg[n].msg_hdr.msg_iovlen = 1;
+			r->msg[n].msg_hdr.msg_control = r->cmsg[n];
+			r->msg[n].msg_hdr.msg_controllen = sizeof ( r->cmsg[n] );
+
+			struct cmsghdr *cm = CMSG_FIRSTHDR ( &r->msg[n].msg_hdr );
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN ( sizeof ( uint16_t ) );
+			*(uint16_t *)CMSG_DATA ( cm ) = (uint16_t)seg;
+
+			off += size;
+		}
+
+		int s = sendmmsg ( fd, r->msg, n, MSG_DONTWAIT );
+
+		if ( s == -1 && errno == EINTR ) continue;
+
+		if ( s == -1 && *sent == 0 && ( errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ) ) return 0;
+
+		// An error after a part was sent ( ICMP of an earlier datagram ) is left to the next call
+		if ( s == -1 ) return ( errno == EAGAIN || errno == ENOBUFS || *sent ) ? 1 : -1;
+
+		uint32_t i = 0; for ( i = 0; i < (uint32_t)s; i++ )
+		{
+			uint32_t size = MIN ( end - *sent, GSO_SEGS * RTP_DGRAM );
+
+			r->seq = (uint16_t)( r->seq + ( size + RTP_DGRAM - 1 ) / RTP_DGRAM );
+			*sent += size;
+		}
+	}
+
+	return 1;
+}
+
+ssize_t rtp_send ( Rtp *r, int fd, const struct sockaddr *dst, socklen_t dst_len, const uint8_t *buf, uint32_t len )
+{
+	uint32_t time = rtp_clock ();
+	uint32_t sent = 0, end = len / TS_SIZE * TS_SIZE;
+
+	int gso = ( r->gso ) ? rtp_send_gso ( r, fd, buf, end, &sent ) : 0;
+
+	if ( gso == -1 ) return -1;
+
+	if ( r->gso && gso == 0 )
+	{
+		g_message ( "%s:: UDP GSO is not available, using sendmmsg ( ).", __func__ );
+
+		r->gso = FALSE;
+	}
+
+	while ( !r->gso && sent < end )
+	{
+		uint32_t n = 0, off = sent;
+
+		for ( n = 0; n < RTP_BATCH && off < end; n++ )
+		{
+			uint32_t size = MIN ( end - off, RTP_DGRAM ), k = 0;
+			struct iovec *iov = r->iov[n];
+
+			if ( r->rtp )
+			{
+				rtp_header ( r, r->hdr[n], (uint16_t)( r->seq + n ), time );
+
+				iov[k].iov_base = r->hdr[n];
+				iov[k++].iov_len = RTP_HDR;
+			}
+
+			iov[k].iov_base = (void *)( buf + off );
+			iov[k++].iov_len = size;
+
+			memset ( &r->msg[n], 0, sizeof ( struct mmsghdr ) );
+			r->msg[n].msg_hdr.msg_name = (void *)dst;
+			r->msg[n].msg_hdr.msg_namelen = dst_len;
+			r->msg[n].msg_hdr.msg_iov = iov;
+			r->msg[n].msg_hdr.msg_iovlen = k;
+
+			off += size;
+		}
+
+		int s = sendmmsg ( fd, r->msg, n, MSG_DONTWAIT );
+
+		if ( s == -1 && errno == EINTR ) continue;
+
+		// Socket buffer full: the caller keeps or drops the rest
+		if ( s == -1 ) { if ( errno == EAGAIN || errno == ENOBUFS || sent ) break; return -1; }
+
+		r->seq = (uint16_t)( r->seq + s );
+		sent = MIN ( sent + (uint32_t)s * RTP_DGRAM, end );
+	}
+
+	if ( r->pace ) rtp_pace ( r, sent );
+
+	return (ssize_t)sent;
+}
+
+// "udp://host:port" or "rtp://host:port"
+gboolean rtp_uri ( const char *uri )
+{
+	return g_str_has_prefix ( uri, "udp://" ) || g_str_has_prefix ( uri, "rtp://" );
+}
+
+static gboolean rtp_parse ( const char *uri, struct sockaddr_in *addr )
+{
+	char host[256] = "";
+	uint32_t port = 0;
+
+	if ( sscanf ( uri + strlen ( "udp://" ), "%255[^:]:%u", host, &port ) != 2 || port == 0 || port > 65535 ) return FALSE;
+
+	struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM }, *res = NULL;
+
+	if ( getaddrinfo ( host, NULL, &hints, &res ) != 0 ) return FALSE;
+
+	*addr = *(struct sockaddr_in *)res->ai_addr;
+	addr->sin_port = htons ( (uint16_t)port );
+
+	freeaddrinfo ( res );
+
+	return TRUE;
+}
+
+Rtp * rtp_open ( const char *uri, uint8_t ttl, gboolean pace, int *fd, const char **error )
+{
+	struct sockaddr_in addr;
+
+	if ( !rtp_uri ( uri ) || !rtp_parse ( uri, &addr ) ) { *error = "Bad address: udp://host:port or rtp://host:port"; return NULL; }
+
+	int sock = socket ( AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 );
+
+	if ( sock == -1 ) { perror ( "Cannot create socket" ); *error = "Cannot create socket"; return NULL; }
+
+	int val = MAX ( ttl, 1 );
+
+	if ( IN_MULTICAST ( ntohl ( addr.sin_addr.s_addr ) ) )
+		setsockopt ( sock, IPPROTO_IP, IP_MULTICAST_TTL, &val, sizeof ( val ) );
+	else
+		setsockopt ( sock, IPPROTO_IP, IP_TTL, &val, sizeof ( val ) );
+
+	// One capture block in flight
+	val = 4 * 1024 * 1024;
+	setsockopt ( sock, SOL_SOCKET, SO_SNDBUF, &val, sizeof ( val ) );
+
+	// Connected: no route lookup per datagram
+	if ( connect ( sock, (struct sockaddr *)&addr, sizeof ( addr ) ) == -1 )
+	{
+		perror ( "Cannot connect socket" );
+		close ( sock );
+		*error = "Cannot connect socket";
+
+		return NULL;
+	}
+
+	Rtp *r = rtp_new ( g_str_has_prefix ( uri, "rtp://" ) );
+
+	val = 0;
+	r->gso = ( setsockopt ( sock, SOL_UDP, UDP_SEGMENT, &val, sizeof ( val ) ) == 0 );
+
+	if ( r->gso && r->rtp ) r->stage = g_malloc ( (gsize)GSO_BATCH * GSO_SEGS * ( RTP_DGRAM + RTP_HDR ) );
+
+	r->pace = pace;
+	r->pace_fd = sock;
+	clock_gettime ( CLOCK_MONOTONIC, &r->pace_t );
+
+	*fd = sock;
+
+	return r;
+}
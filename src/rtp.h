@@ -0,0 +1,36 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <sys/socket.h>
+
+#define RTP_TS_PACKETS 7
+
+/*
+ * MPEG-TS over UDP: 7 packets per datagram, behind an RTP header ( RFC 2250, PT 33 ) or raw.
+ * A buffer goes out in sendmmsg ( ) batches, one syscall per 64 datagrams;
+ * on a socket of rtp_open ( ) with UDP GSO, one syscall per ~ 380 datagrams.
+ */
+
+typedef struct _Rtp Rtp;
+
+Rtp * rtp_new ( gboolean rtp );
+
+void rtp_free ( Rtp * );
+
+// The whole packets of buf to dst ( NULL: connected ); returns the TS bytes sent ( short on a full socket ), -1 on error
+ssize_t rtp_send ( Rtp *, int fd, const struct sockaddr *dst, socklen_t dst_len, const uint8_t *buf, uint32_t len );
+
+// "udp://host:port" or "rtp://host:port"
+gboolean rtp_uri ( const char *uri );
+
+// Connected socket to uri, unicast or multicast; pace: kernel pacing at the stream bitrate ( needs the fq qdisc )
+Rtp * rtp_open ( const char *uri, uint8_t ttl, gboolean pace, int *fd, const char **error );
@@ -0,0 +1,222 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "scan-cache.h"
+
+#include <libdvbv5/pat.h>
+#include <libdvbv5/sdt.h>
+#include <libdvbv5/nit.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SCAN_CACHE_NONE -2 // no such key
+
+struct _ScanCache
+{
+	GMutex mutex;
+
+	char *dir;
+	char *file;
+	GKeyFile *index; // group per transponder
+
+	uint8_t detect, nit;
+};
+
+typedef struct _ScanTables ScanTables;
+
+struct _ScanTables
+{
+	int onid, tsid;
+	int pat, sdt, nit; // versions, nit -1: not read
+};
+
+ScanCache * scan_cache_new ( uint8_t detect, uint8_t nit )
+{
+	g_autofree char *dir = g_build_filename ( g_get_user_cache_dir (), "dvbv5-gtk", "scan", NULL );
+
+	if ( g_mkdir_with_parents ( dir, 0755 ) == -1 ) { perror ( "Cannot create scan cache" ); return NULL; }
+
+	ScanCache *cache = g_new0 ( ScanCache, 1 );
+
+	g_mutex_init ( &cache->mutex );
+
+	cache->dir = g_steal_pointer ( &dir );
+	cache->file = g_build_filename ( cache->dir, "index.ini", NULL );
+	cache->index = g_key_file_new ();
+	cache->detect = detect;
+	cache->nit = nit;
+
+	// First scan: no index yet
+	g_key_file_load_from_file ( cache->index, cache->file, G_KEY_FILE_NONE, NULL );
+
+	return cache;
+}
+
+void scan_cache_free ( ScanCache *cache )
+{
+	g_key_file_free ( cache->index );
+	g_mutex_clear ( &cache->mutex );
+
+	free ( cache->file );
+	free ( cache->dir );
+	free ( cache );
+}
+
+static gboolean scan_cache_tables ( struct dvb_v5_descriptors *handler, ScanTables *t )
+{
+	if ( !handler || !handler->pat || !handler->sdt ) return FALSE;
+
+	t->tsid = handler->pat->header.id;
+	t->pat  = handler->pat->header.version;
+	t->onid = handler->sdt->network_id;
+	t->sdt  = handler->sdt->header.version;
+	t->nit  = ( handler->nit ) ? handler->nit->header.version : -1;
+
+	return TRUE;
+}
+
+static char * scan_cache_group ( struct dvb_v5_fe_parms *parms, struct dvb_entry *entry )
+{
+	uint32_t sys = parms->current_sys, freq = 0, pol = POLARIZATION_OFF, stream_id = NO_STREAM_ID_FILTER;
+
+	dvb_retrieve_entry_prop ( entry, DTV_DELIVERY_SYSTEM, &sys );
+	dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &freq );
+	dvb_retrieve_entry_prop ( entry, DTV_POLARIZATION, &pol );
+	dvb_retrieve_entry_prop ( entry, DTV_STREAM_ID, &stream_id );
+
+	return g_strdup_printf ( "%u-%d-%u-%u-%u", sys, parms->sat_number, freq, pol, stream_id );
+}
+
+static int scan_cache_int ( ScanCache *cache, const char *group, const char *key )
+{
+	GError *error = NULL;
+
+	int val = g_key_file_get_integer ( cache->index, group, key, &error );
+
+	if ( error ) { g_error_free ( error ); return SCAN_CACHE_NONE; }
+
+	return val;
+}
+
+gboolean scan_cache_has ( ScanCache *cache, struct dvb_v5_fe_parms *parms, struct dvb_entry *entry )
+{
+	g_autofree char *group = scan_cache_group ( parms, entry );
+
+	g_mutex_lock ( &cache->mutex );
+
+	int channels = scan_cache_int ( cache, group, "channels" );
+
+	g_mutex_unlock ( &cache->mutex );
+
+	return ( channels != SCAN_CACHE_NONE );
+}
+
+struct dvb_v5_descriptors * scan_cache_probe ( struct dvb_v5_fe_parms *parms, struct dvb_open_descriptor *dmx_fd, struct dvb_entry *entry, uint8_t time_mult, gboolean nit, 
+	check_frontend_t *check, void *args )
+{
+	// ATSC: a VCT, not an SDT
+	if ( parms->current_sys == SYS_ATSC || parms->current_sys == SYS_DVBC_ANNEX_B ) return NULL;
+
+	uint32_t i = 0; for ( i = 0; i < entry->n_props; i++ )
+	{
+		uint32_t cmd = entry->props[i].cmd, data = entry->props[i].u.data;
+
+		if ( cmd == DTV_DELIVERY_SYSTEM )
+			{ if ( data != parms->current_sys ) dvb_set_compat_delivery_system ( parms, data ); }
+		else
+			dvb_fe_store_parm ( parms, cmd, data );
+	}
+
+	if ( dvb_fe_set_parms ( parms ) < 0 || check ( args, parms ) < 0 ) return NULL;
+
+	int fd = dvb_dev_get_fd ( dmx_fd );
+
+	struct dvb_v5_descriptors *handler = calloc ( 1, sizeof ( struct dvb_v5_descriptors ) );
+
+	handler->delivery_system = parms->current_sys;
+
+	// The timeouts of a full scan
+	if ( dvb_read_section ( parms, fd, DVB_TABLE_PAT, DVB_TABLE_PAT_PID, (void **)&handler->pat, 1 * time_mult ) < 0
+		|| dvb_read_section ( parms, fd, DVB_TABLE_SDT, DVB_TABLE_SDT_PID, (void **)&handler->sdt, 2 * time_mult ) < 0 )
+	{
+		dvb_scan_free_handler_table ( handler );
+
+		return NULL;
+	}
+
+	if ( nit && dvb_read_section ( parms, fd, DVB_TABLE_NIT, DVB_TABLE_NIT_PID, (void **)&handler->nit, 12 * time_mult ) < 0 ) handler->nit = NULL;
+
+	return handler;
+}
+
+struct dvb_file * scan_cache_get ( ScanCache *cache, struct dvb_v5_fe_parms *parms, struct dvb_entry *entry, struct dvb_v5_descriptors *probe )
+{
+	ScanTables t;
+
+	if ( !scan_cache_tables ( probe, &t ) ) return NULL;
+
+	g_autofree char *group = scan_cache_group ( parms, entry );
+
+	g_mutex_lock ( &cache->mutex );
+
+	int nit = scan_cache_int ( cache, group, "nit" );
+
+	gboolean hit = scan_cache_int ( cache, group, "onid" ) == t.onid && scan_cache_int ( cache, group, "tsid" ) == t.tsid
+		&& scan_cache_int ( cache, group, "pat" ) == t.pat && scan_cache_int ( cache, group, "sdt" ) == t.sdt
+		&& ( nit == -1 || t.nit == -1 || nit == t.nit )
+		&& scan_cache_int ( cache, group, "detect" ) == cache->detect && scan_cache_int ( cache, group, "get-nit" ) == cache->nit;
+
+	int channels = scan_cache_int ( cache, group, "channels" );
+
+	g_mutex_unlock ( &cache->mutex );
+
+	if ( !hit || channels < 0 ) return NULL;
+
+	if ( channels == 0 ) return calloc ( 1, sizeof ( struct dvb_file ) );
+
+	g_autofree char *name = g_strconcat ( group, ".conf", NULL );
+	g_autofree char *path = g_build_filename ( cache->dir, name, NULL );
+
+	return dvb_read_file_format ( path, parms->current_sys, FILE_DVBV5 );
+}
+
+void scan_cache_put ( ScanCache *cache, struct dvb_v5_fe_parms *parms, struct dvb_entry *entry, struct dvb_v5_descriptors *handler, struct dvb_file *channels )
+{
+	ScanTables t;
+
+	if ( !scan_cache_tables ( handler, &t ) ) return;
+
+	g_autofree char *group = scan_cache_group ( parms, entry );
+	g_autofree char *name = g_strconcat ( group, ".conf", NULL );
+	g_autofree char *path = g_build_filename ( cache->dir, name, NULL );
+
+	int n = 0;
+	struct dvb_entry *e = NULL; for ( e = ( channels ) ? channels->first_entry : NULL; e; e = e->next ) n++;
+
+	if ( n && dvb_write_file_format ( path, channels, parms->current_sys, FILE_DVBV5 ) < 0 ) { g_warning ( "%s:: Write %s failed.", __func__, path ); return; }
+
+	g_mutex_lock ( &cache->mutex );
+
+	g_key_file_set_integer ( cache->index, group, "onid", t.onid );
+	g_key_file_set_integer ( cache->index, group, "tsid", t.tsid );
+	g_key_file_set_integer ( cache->index, group, "pat",  t.pat  );
+	g_key_file_set_integer ( cache->index, group, "sdt",  t.sdt  );
+	g_key_file_set_integer ( cache->index, group, "nit",  t.nit  );
+	g_key_file_set_integer ( cache->index, group, "detect",   cache->detect );
+	g_key_file_set_integer ( cache->index, group, "get-nit",  cache->nit );
+	g_key_file_set_integer ( cache->index, group, "channels", n );
+
+	// Saved every transponder: a stopped scan keeps what it found
+	GError *error = NULL;
+
+	if ( !g_key_file_save_to_file ( cache->index, cache->file, &error ) ) { g_warning ( "%s:: %s", __func__, error->message ); g_error_free ( error ); }
+
+	g_mutex_unlock ( &cache->mutex );
+}
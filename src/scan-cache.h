@@ -0,0 +1,42 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-dev.h>
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/dvb-file.h>
+
+#include <glib.h>
+
+/*
+ * Channels of every transponder scanned so far, in g_get_user_cache_dir ( ) / dvbv5-gtk / scan.
+ * A transponder is keyed by its tuning parameters and checked by ONID, TSID and the PAT, SDT, NIT versions:
+ * a probe of these tables takes the place of the PMT reads of a full scan.
+ */
+
+typedef struct _ScanCache ScanCache;
+
+// detect, nit: the dvb_store_channel ( ) options, a cache of other options is not used
+ScanCache * scan_cache_new ( uint8_t detect, uint8_t nit );
+
+void scan_cache_free ( ScanCache * );
+
+// Entry scanned before: worth a probe
+gboolean scan_cache_has ( ScanCache *, struct dvb_v5_fe_parms *parms, struct dvb_entry *entry );
+
+// Tunes entry, waits for check and reads the PAT, SDT ( and NIT ): a handler without programs, NULL on error
+struct dvb_v5_descriptors * scan_cache_probe ( struct dvb_v5_fe_parms *parms, struct dvb_open_descriptor *dmx_fd, struct dvb_entry *entry, uint8_t time_mult, gboolean nit, 
+	check_frontend_t *check, void *args );
+
+// The channels of entry, when the tables of the probe have not changed; NULL: scan it
+struct dvb_file * scan_cache_get ( ScanCache *, struct dvb_v5_fe_parms *parms, struct dvb_entry *entry, struct dvb_v5_descriptors *probe );
+
+// After a full scan; channels: NULL, none
+void scan_cache_put ( ScanCache *, struct dvb_v5_fe_parms *parms, struct dvb_entry *entry, struct dvb_v5_descriptors *handler, struct dvb_file *channels );
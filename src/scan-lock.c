@@ -0,0 +1,179 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "scan-lock.h"
+
+#include <libdvbv5/dvb-scan.h>
+
+#include <stdlib.h>
+
+#define SCAN_LOCK_POLL_US   10000
+#define SCAN_LOCK_SIGNAL_US 300000 // the least wait for a carrier
+#define SCAN_LOCK_TABLES_MIN 3     // transponders read before the table timeouts scale
+
+struct _ScanLock
+{
+	GMutex mutex;
+
+	uint8_t time_mult;
+
+	// Transponders locked: the slowest carrier, lock and table reads
+	uint32_t n_lock, n_fast, n_dead;
+	int64_t max_signal;
+	int64_t sum_lock, sum_tables, saved;
+
+	// Table reads done: the slowest; a read failed on a scaled time_mult, the user's one from then on
+	uint32_t n_tables;
+	int64_t max_tables;
+	gboolean tables_full;
+
+	// Lock times with and without a band / polarization switch
+	uint32_t n_sw, n_same;
+	int64_t sum_sw, sum_same;
+};
+
+ScanLock * scan_lock_new ( uint8_t time_mult )
+{
+	ScanLock *lock = g_new0 ( ScanLock, 1 );
+
+	g_mutex_init ( &lock->mutex );
+
+	lock->time_mult = MAX ( time_mult, 1 );
+
+	return lock;
+}
+
+void scan_lock_free ( ScanLock *lock )
+{
+	g_mutex_clear ( &lock->mutex );
+
+	free ( lock );
+}
+
+// The full wait: as the table timeouts of a fixed time_mult
+static inline int64_t scan_lock_full ( ScanLock *lock )
+{
+	return (int64_t)lock->time_mult * G_USEC_PER_SEC;
+}
+
+uint8_t scan_lock_start ( ScanLock *lock, ScanLockTp *tp, uint32_t freq, int8_t sw )
+{
+	g_mutex_lock ( &lock->mutex );
+
+	// Seconds: twice the slowest table reads so far, rounded up
+	uint8_t time_mult = ( lock->n_tables >= SCAN_LOCK_TABLES_MIN && !lock->tables_full )
+		? (uint8_t)CLAMP ( ( 2 * lock->max_tables + G_USEC_PER_SEC - 1 ) / G_USEC_PER_SEC, 1, lock->time_mult ) : lock->time_mult;
+
+	g_mutex_unlock ( &lock->mutex );
+
+	*tp = (ScanLockTp){ .lock = lock, .freq = freq, .start = g_get_monotonic_time (), .time_mult = time_mult, .sw = sw };
+
+	return time_mult;
+}
+
+int scan_lock_check ( void *args, struct dvb_v5_fe_parms *parms )
+{
+	ScanLockTp *tp = args;
+	ScanLock *lock = tp->lock;
+
+	// Called again after a cache probe: given up once, counted once
+	if ( tp->dead ) return -1;
+
+	g_mutex_lock ( &lock->mutex );
+
+	// Twice the slowest carrier seen; none locked yet: the full wait
+	int64_t full = scan_lock_full ( lock );
+	int64_t bound = ( lock->n_lock ) ? CLAMP ( 2 * lock->max_signal, SCAN_LOCK_SIGNAL_US, full ) : full;
+
+	g_mutex_unlock ( &lock->mutex );
+
+	// Locked by the probe: the retune of the scan waits from now
+	int64_t begin = ( tp->locked ) ? g_get_monotonic_time () - tp->start : 0;
+
+	while ( !parms->abort )
+	{
+		int64_t now = g_get_monotonic_time () - tp->start;
+
+		fe_status_t status = 0;
+
+		if ( dvb_fe_get_stats ( parms ) == 0 ) dvb_fe_retrieve_stats ( parms, DTV_STATUS, &status );
+
+		if ( !tp->signal && ( status & FE_HAS_SIGNAL ) ) tp->signal = MAX ( now, 1 );
+
+		if ( status & FE_HAS_LOCK ) { if ( !tp->locked ) tp->locked = MAX ( now, 1 ); return 0; }
+
+		if ( !tp->signal && now > bound ) break;
+
+		if ( now - begin > full ) break;
+
+		g_usleep ( SCAN_LOCK_POLL_US );
+	}
+
+	tp->dead = TRUE;
+
+	g_mutex_lock ( &lock->mutex );
+
+	lock->n_dead++;
+
+	// A fixed time_mult waits out the PAT timeout on a dead frequency
+	if ( !tp->signal ) { lock->n_fast++; lock->saved += full - ( g_get_monotonic_time () - tp->start ); }
+
+	g_mutex_unlock ( &lock->mutex );
+
+	dvb_log ( "%u: no %s after %u ms", tp->freq, ( tp->signal ) ? "lock" : "signal", (uint32_t)( ( g_get_monotonic_time () - tp->start ) / 1000 ) );
+
+	return -1;
+}
+
+void scan_lock_done ( ScanLockTp *tp, gboolean tables )
+{
+	if ( !tp->locked ) return;
+
+	ScanLock *lock = tp->lock;
+	int64_t table = g_get_monotonic_time () - tp->start - tp->locked;
+
+	g_mutex_lock ( &lock->mutex );
+
+	lock->n_lock++;
+	lock->max_signal = MAX ( lock->max_signal, tp->signal );
+	lock->sum_lock   += tp->locked;
+	lock->sum_tables += table;
+
+	if ( tables ) { lock->n_tables++; lock->max_tables = MAX ( lock->max_tables, table ); }
+
+	if ( !tables && tp->time_mult < lock->time_mult ) lock->tables_full = TRUE;
+
+	if ( tp->sw == 1 ) { lock->n_sw++;   lock->sum_sw   += tp->locked; }
+	if ( tp->sw == 0 ) { lock->n_same++; lock->sum_same += tp->locked; }
+
+	g_mutex_unlock ( &lock->mutex );
+
+	dvb_log ( "%u: signal %u ms, lock %u ms, tables %u ms ( time_mult %u )%s", 
+		tp->freq, (uint32_t)( tp->signal / 1000 ), (uint32_t)( tp->locked / 1000 ), (uint32_t)( table / 1000 ), tp->time_mult, ( tables ) ? "" : " ( failed )" );
+}
+
+int64_t scan_lock_switch ( ScanLock *lock )
+{
+	g_mutex_lock ( &lock->mutex );
+
+	int64_t cost = ( lock->n_sw && lock->n_same ) ? MAX ( lock->sum_sw / lock->n_sw - lock->sum_same / lock->n_same, 0 ) : -1;
+
+	g_mutex_unlock ( &lock->mutex );
+
+	return cost;
+}
+
+void scan_lock_report ( ScanLock *lock )
+{
+	uint32_t n = MAX ( lock->n_lock, 1 );
+
+	g_message ( "%s:: locked %u ( lock %u ms, tables %u ms average, %u ms max%s ), not locked %u ( no signal %u ); %u ms saved ", __func__, lock->n_lock, 
+		(uint32_t)( lock->sum_lock / n / 1000 ), (uint32_t)( lock->sum_tables / n / 1000 ), (uint32_t)( lock->max_tables / 1000 ), ( lock->tables_full ) ? ", not scaled" : "",
+		lock->n_dead, lock->n_fast, (uint32_t)( MAX ( lock->saved, 0 ) / 1000 ) );
+}
@@ -0,0 +1,55 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-fe.h>
+
+#include <glib.h>
+
+/*
+ * Adaptive lock wait of a scan, shared by every tuner.
+ * The frontend status is polled every 10 ms: no carrier within a bound learned from the transponders locked so far is given up.
+ * The table timeouts follow the slowest table reads seen, up to time_mult; a failed read on a lower one ends the scaling.
+ */
+
+typedef struct _ScanLock ScanLock;
+
+// One transponder: the args of scan_lock_check ( )
+typedef struct _ScanLockTp ScanLockTp;
+
+struct _ScanLockTp
+{
+	ScanLock *lock;
+	uint32_t freq;
+
+	int64_t start, signal, locked; // us, signal and locked: 0 not yet
+	gboolean dead;
+
+	uint8_t time_mult; // of the table reads
+	int8_t sw;         // band / polarization switched: 1, not: 0, first tune of the tuner: -1
+};
+
+ScanLock * scan_lock_new ( uint8_t time_mult );
+
+void scan_lock_free ( ScanLock * );
+
+// Before scan_cache_probe ( ) and dvb_dev_scan ( ): the args of their check_frontend; returns the time_mult of the table reads
+uint8_t scan_lock_start ( ScanLock *, ScanLockTp *tp, uint32_t freq, int8_t sw );
+
+// The check_frontend of dvb_dev_scan ( ) and scan_cache_probe ( ): 0 locked, -1 give up
+int scan_lock_check ( void *args, struct dvb_v5_fe_parms *parms );
+
+// After the transponder, once: the lock and table latency
+void scan_lock_done ( ScanLockTp *tp, gboolean tables );
+
+// The lock time after a band / polarization switch less the one without, us; -1: not both seen
+int64_t scan_lock_switch ( ScanLock * );
+
+void scan_lock_report ( ScanLock * );
@@ -0,0 +1,494 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "scan.h"
+
+#include <libdvbv5/dvb-sat.h>
+
+#include <stdlib.h>
+
+#define SCAN_BUCKET_KHZ 1000    // satellite: kHz
+#define SCAN_BUCKET_HZ  1000000 // cable, terrestrial: Hz
+
+#define SCAN_GROUPS 17    // 1 + band << 3 | polarization
+
+typedef struct _ScanKey ScanKey;
+
+// A frequency bucket of one delivery system family, polarization and stream id
+struct _ScanKey
+{
+	uint32_t bucket;
+	uint32_t stream_id;
+	uint8_t  sys;
+	uint8_t  pol;
+};
+
+struct _ScanQueue
+{
+	GMutex mutex;
+	GCond  cond;
+
+	struct dvb_file *file; // handed out; the pending ones on free
+	struct dvb_entry *tail;
+
+	// Pending, one list per band / polarization by frequency: a tuner stays in its group
+	struct dvb_entry *pending[SCAN_GROUPS];
+
+	// Every transponder of the list, by bucket: a duplicate within the shift is found in 2 - 3 lookups
+	GHashTable *index; // ScanKey -> GSList of frequencies
+	uint32_t sys;      // of the file, when an entry has none
+
+	uint8_t  busy; // tuners scanning: their NIT may add transponders
+	uint32_t count;
+	gboolean stop;
+
+	// Band / polarization switches: in arrival order ( estimated ), done by the tuners
+	const struct dvb_sat_lnb *lnb;
+	uint32_t groups, fifo_group;
+	uint32_t sw_fifo, sw_done;
+	gboolean sat;
+};
+
+static guint scan_key_hash ( gconstpointer key )
+{
+	const ScanKey *k = key;
+
+	return k->bucket * 2654435761u ^ k->stream_id * 40503u ^ (guint)( k->sys << 8 | k->pol );
+}
+
+static gboolean scan_key_equal ( gconstpointer a, gconstpointer b )
+{
+	const ScanKey *x = a, *y = b;
+
+	return x->bucket == y->bucket && x->stream_id == y->stream_id && x->sys == y->sys && x->pol == y->pol;
+}
+
+// S / S2 on one frequency is one transponder
+static uint8_t scan_sys_family ( uint32_t sys )
+{
+	switch ( sys )
+	{
+		case SYS_DVBS:
+		case SYS_DVBS2:
+		case SYS_TURBO:
+		case SYS_ISDBS:
+		case SYS_DSS:
+			return 1;
+		case SYS_DVBC_ANNEX_A:
+		case SYS_DVBC_ANNEX_B:
+		case SYS_DVBC_ANNEX_C:
+			return 2;
+		default:
+			return 3;
+	}
+}
+
+// 1 + band, polarization of a satellite; 0: no frequency
+static uint32_t scan_group ( ScanQueue *queue, struct dvb_entry *entry, uint32_t *freq )
+{
+	uint32_t pol = POLARIZATION_OFF;
+
+	if ( dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, freq ) ) return 0;
+
+	if ( !queue->sat ) return 1;
+
+	dvb_retrieve_entry_prop ( entry, DTV_POLARIZATION, &pol );
+
+	uint32_t band = ( queue->lnb && queue->lnb->rangeswitch && *freq >= queue->lnb->rangeswitch * 1000 ) ? 1 : 0;
+
+	return 1 + ( band << 3 | ( pol & 7 ) );
+}
+
+static uint32_t scan_freq ( struct dvb_entry *entry )
+{
+	uint32_t freq = 0;
+
+	dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &freq );
+
+	return freq;
+}
+
+// Insertion sort into the list of its group; the frequencies of a file mostly come in order: the tail first
+static void scan_queue_append ( ScanQueue *queue, struct dvb_entry *entry )
+{
+	uint32_t freq = 0, group = scan_group ( queue, entry, &freq );
+
+	struct dvb_entry **p = &queue->pending[group], *last = NULL;
+
+	for ( last = *p; last && last->next; last = last->next );
+
+	if ( last && scan_freq ( last ) <= freq )
+		p = &last->next;
+	else
+		while ( *p && scan_freq ( *p ) <= freq ) p = &(*p)->next;
+
+	entry->next = *p;
+	*p = entry;
+
+	if ( queue->fifo_group && queue->fifo_group != group ) queue->sw_fifo++;
+
+	queue->fifo_group = group;
+	queue->groups |= 1u << ( group - 1 );
+}
+
+static gboolean scan_index_key ( ScanQueue *queue, struct dvb_entry *entry, ScanKey *key, uint32_t *freq )
+{
+	uint32_t sys = queue->sys, pol = POLARIZATION_OFF, stream_id = NO_STREAM_ID_FILTER;
+
+	if ( dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, freq ) ) return FALSE;
+
+	dvb_retrieve_entry_prop ( entry, DTV_DELIVERY_SYSTEM, &sys );
+	dvb_retrieve_entry_prop ( entry, DTV_POLARIZATION, &pol );
+	dvb_retrieve_entry_prop ( entry, DTV_STREAM_ID, &stream_id );
+
+	key->sys = scan_sys_family ( sys );
+	key->pol = (uint8_t)pol;
+	key->stream_id = stream_id;
+
+	return TRUE;
+}
+
+static inline uint32_t scan_bucket ( const ScanKey *key, uint32_t freq )
+{
+	return freq / ( ( key->sys == 1 ) ? SCAN_BUCKET_KHZ : SCAN_BUCKET_HZ );
+}
+
+static gboolean scan_index_find ( ScanQueue *queue, ScanKey *key, uint32_t freq, uint32_t shift )
+{
+	uint32_t b = 0, b1 = scan_bucket ( key, ( freq > shift ) ? freq - shift : 0 ), b2 = scan_bucket ( key, freq + shift );
+
+	for ( b = b1; b <= b2; b++ )
+	{
+		key->bucket = b;
+
+		GSList *l = NULL; for ( l = g_hash_table_lookup ( queue->index, key ); l; l = l->next )
+		{
+			uint32_t f = GPOINTER_TO_UINT ( l->data );
+
+			if ( ( ( f > freq ) ? f - freq : freq - f ) <= shift ) return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static void scan_index_add ( ScanQueue *queue, ScanKey *key, uint32_t freq )
+{
+	key->bucket = scan_bucket ( key, freq );
+
+	GSList *list = g_hash_table_lookup ( queue->index, key );
+
+	if ( list ) { list = g_slist_append ( list, GUINT_TO_POINTER ( freq ) ); return; }
+
+	ScanKey *k = g_new ( ScanKey, 1 );
+	*k = *key;
+
+	g_hash_table_insert ( queue->index, k, g_slist_prepend ( NULL, GUINT_TO_POINTER ( freq ) ) );
+}
+
+// An entry without a frequency, or within the shift of one in the list, is a duplicate
+static gboolean scan_index_new ( ScanQueue *queue, struct dvb_entry *entry, uint32_t shift )
+{
+	ScanKey key;
+	uint32_t freq = 0;
+
+	if ( !scan_index_key ( queue, entry, &key, &freq ) || scan_index_find ( queue, &key, freq, shift ) ) return FALSE;
+
+	scan_index_add ( queue, &key, freq );
+
+	return TRUE;
+}
+
+// Entries of a private list, freed with it
+static void scan_entries_free ( struct dvb_entry *entry )
+{
+	if ( !entry ) return;
+
+	struct dvb_file *file = calloc ( 1, sizeof ( struct dvb_file ) );
+
+	file->first_entry = entry;
+
+	dvb_file_free ( file );
+}
+
+ScanQueue * scan_queue_new ( struct dvb_file *file, struct dvb_v5_fe_parms *parms )
+{
+	ScanQueue *queue = g_new0 ( ScanQueue, 1 );
+
+	g_mutex_init ( &queue->mutex );
+	g_cond_init  ( &queue->cond  );
+
+	queue->file = file;
+	queue->sys = parms->current_sys;
+	queue->index = g_hash_table_new_full ( scan_key_hash, scan_key_equal, free, (GDestroyNotify)g_slist_free );
+
+	queue->sat = ( scan_sys_family ( parms->current_sys ) == 1 );
+	queue->lnb = parms->lnb;
+
+	// The duplicates of the file go now, the rest to the lists of their groups
+	uint32_t shift = (uint32_t)MAX ( dvb_estimate_freq_shift ( parms ), 0 );
+
+	struct dvb_entry *entry = file->first_entry, *next = NULL, *dup = NULL, **dup_tail = &dup;
+
+	file->first_entry = NULL;
+
+	for ( ; entry; entry = next )
+	{
+		next = entry->next;
+		entry->next = NULL;
+
+		if ( scan_index_new ( queue, entry, shift ) )
+			scan_queue_append ( queue, entry );
+		else
+			{ *dup_tail = entry; dup_tail = &entry->next; }
+	}
+
+	scan_entries_free ( dup );
+
+	return queue;
+}
+
+void scan_queue_free ( ScanQueue *queue )
+{
+	// Not scanned ( stopped ): freed with the file
+	uint8_t g = 0; for ( g = 0; g < SCAN_GROUPS; g++ )
+	{
+		struct dvb_entry *entry = queue->pending[g], *next = NULL;
+
+		for ( ; entry; entry = next )
+		{
+			next = entry->next;
+			entry->next = NULL;
+
+			if ( queue->tail ) queue->tail->next = entry; else queue->file->first_entry = entry;
+			queue->tail = entry;
+		}
+	}
+
+	g_hash_table_destroy ( queue->index );
+
+	g_mutex_clear ( &queue->mutex );
+	g_cond_clear  ( &queue->cond  );
+
+	free ( queue );
+}
+
+struct dvb_entry * scan_queue_next ( ScanQueue *queue, uint32_t *group, uint32_t *freq, uint32_t *num )
+{
+	struct dvb_entry *entry = NULL;
+	uint32_t g = 0;
+
+	g_mutex_lock ( &queue->mutex );
+
+	while ( !queue->stop && !entry )
+	{
+		// The group of this tuner goes on, else the first one left
+		g = ( *group < SCAN_GROUPS && queue->pending[*group] ) ? *group : 1;
+
+		while ( g < SCAN_GROUPS && !queue->pending[g] ) g++;
+
+		if ( g == SCAN_GROUPS )
+		{
+			if ( !queue->busy ) break;
+
+			g_cond_wait ( &queue->cond, &queue->mutex );
+
+			continue;
+		}
+
+		entry = queue->pending[g];
+		queue->pending[g] = entry->next;
+		entry->next = NULL;
+
+		if ( queue->tail ) queue->tail->next = entry; else queue->file->first_entry = entry;
+		queue->tail = entry;
+	}
+
+	if ( entry )
+	{
+		*freq = scan_freq ( entry );
+
+		if ( *group && *group != g ) queue->sw_done++;
+
+		*group = g;
+
+		queue->busy++; *num = ++queue->count;
+	}
+
+	g_mutex_unlock ( &queue->mutex );
+
+	return entry;
+}
+
+void scan_queue_done ( ScanQueue *queue, struct dvb_v5_fe_parms *parms, struct dvb_v5_descriptors *handler, struct dvb_entry *entry )
+{
+	struct dvb_entry *found = NULL, *dup = NULL, **dup_tail = &dup;
+
+	if ( handler )
+	{
+		// libdvbv5 checks and appends to the list it gets: a copy of entry alone, out of the lock
+		struct dvb_entry *tmpl = g_new ( struct dvb_entry, 1 );
+
+		*tmpl = *entry;
+		tmpl->next = NULL;
+
+		dvb_add_scaned_transponders ( parms, handler, tmpl, tmpl );
+
+		found = tmpl->next;
+		free ( tmpl );
+	}
+
+	uint32_t shift = ( found ) ? (uint32_t)MAX ( dvb_estimate_freq_shift ( parms ), 0 ) : 0;
+
+	g_mutex_lock ( &queue->mutex );
+
+	struct dvb_entry *next = NULL; for ( ; found; found = next )
+	{
+		next = found->next;
+		found->next = NULL;
+
+		// Appended: the tuners waiting at the end of the list go on
+		if ( !queue->stop && scan_index_new ( queue, found, shift ) )
+			scan_queue_append ( queue, found );
+		else
+			{ *dup_tail = found; dup_tail = &found->next; }
+	}
+
+	queue->busy--;
+
+	g_cond_broadcast ( &queue->cond );
+	g_mutex_unlock ( &queue->mutex );
+
+	scan_entries_free ( dup );
+}
+
+void scan_queue_stop ( ScanQueue *queue )
+{
+	g_mutex_lock ( &queue->mutex );
+
+	queue->stop = TRUE;
+
+	g_cond_broadcast ( &queue->cond );
+	g_mutex_unlock ( &queue->mutex );
+}
+
+void scan_file_append ( struct dvb_file **dst, struct dvb_file *src )
+{
+	if ( !src ) return;
+
+	if ( !*dst ) { *dst = src; return; }
+
+	struct dvb_entry *tail = (*dst)->first_entry;
+
+	while ( tail && tail->next ) tail = tail->next;
+
+	if ( tail ) tail->next = src->first_entry; else (*dst)->first_entry = src->first_entry;
+
+	(*dst)->n_entries += src->n_entries;
+
+	src->first_entry = NULL;
+	dvb_file_free ( src );
+}
+
+void scan_queue_report ( ScanQueue *queue, int64_t switch_us )
+{
+	if ( !queue->sat ) return;
+
+	uint32_t groups = 0, g = 0; for ( g = queue->groups; g; g &= g - 1 ) groups++;
+
+	if ( switch_us < 0 )
+	{
+		g_message ( "%s:: band / polarization switches: %u in file order, %u planned, %u done; time saved not measured ", 
+			__func__, queue->sw_fifo, ( groups ) ? groups - 1 : 0, queue->sw_done );
+
+		return;
+	}
+
+	int64_t saved = ( (int64_t)queue->sw_fifo - (int64_t)queue->sw_done ) * switch_us / 1000;
+
+	g_message ( "%s:: band / polarization switches: %u in file order, %u planned, %u done; %d ms saved at %u ms per switch ( measured ) ", 
+		__func__, queue->sw_fifo, ( groups ) ? groups - 1 : 0, queue->sw_done, (int)saved, (uint32_t)( switch_us / 1000 ) );
+}
+
+// ONID, TSID, SID; without the ids of the NIT / SDT: frequency, polarization, SID
+static uint64_t scan_merge_key ( struct dvb_entry *entry )
+{
+	if ( entry->network_id || entry->transport_id )
+		return ( (uint64_t)1 << 63 ) | ( (uint64_t)entry->network_id << 32 ) | ( (uint64_t)entry->transport_id << 16 ) | entry->service_id;
+
+	uint32_t freq = 0, pol = POLARIZATION_OFF;
+
+	dvb_retrieve_entry_prop ( entry, DTV_FREQUENCY, &freq );
+	dvb_retrieve_entry_prop ( entry, DTV_POLARIZATION, &pol );
+
+	return ( (uint64_t)freq << 19 ) | ( (uint64_t)( pol & 7 ) << 16 ) | entry->service_id;
+}
+
+struct dvb_file * scan_merge ( struct dvb_file *files[], uint8_t n )
+{
+	struct dvb_file *out = NULL, *dup = NULL;
+	struct dvb_entry *tail = NULL, *dup_tail = NULL;
+	int n_entries = 0;
+
+	GHashTable *keys = g_hash_table_new_full ( g_int64_hash, g_int64_equal, free, NULL );
+
+	uint8_t i = 0; for ( i = 0; i < n; i++ )
+	{
+		if ( !files[i] ) continue;
+
+		struct dvb_entry *entry = files[i]->first_entry, *next = NULL;
+
+		files[i]->first_entry = NULL;
+
+		if ( !out ) { out = files[i]; files[i] = NULL; } else { dvb_file_free ( files[i] ); files[i] = NULL; }
+
+		for ( ; entry; entry = next )
+		{
+			next = entry->next;
+			entry->next = NULL;
+
+			uint64_t key = scan_merge_key ( entry );
+
+			gpointer owner = NULL;
+
+			// Found by another tuner: the duplicates within one tuner's file stay, as a scan on one tuner always did
+			if ( g_hash_table_lookup_extended ( keys, &key, NULL, &owner ) )
+			{
+				if ( GPOINTER_TO_UINT ( owner ) != i + 1u )
+				{
+					// Freed with the file, as libdvbv5 frees an entry
+					if ( !dup ) dup = calloc ( 1, sizeof ( struct dvb_file ) );
+
+					if ( dup_tail ) dup_tail->next = entry; else dup->first_entry = entry;
+					dup_tail = entry;
+
+					continue;
+				}
+			}
+			else
+			{
+				uint64_t *k = g_new ( uint64_t, 1 );
+				*k = key;
+				g_hash_table_insert ( keys, k, GUINT_TO_POINTER ( i + 1u ) );
+			}
+
+			if ( tail ) tail->next = entry; else out->first_entry = entry;
+			tail = entry;
+			n_entries++;
+		}
+	}
+
+	g_hash_table_destroy ( keys );
+
+	if ( dup ) dvb_file_free ( dup );
+
+	if ( out ) out->n_entries = n_entries;
+
+	return out;
+}
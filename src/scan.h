@@ -0,0 +1,49 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <libdvbv5/dvb-fe.h>
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/dvb-file.h>
+
+#include <glib.h>
+
+/*
+ * The transponders of one scan, shared by every tuner: each takes the next one.
+ * The NIT of a scanned transponder may add more until the last tuner is idle.
+ * A hash index by frequency bucket finds a duplicate in O(1), not by a walk of the list.
+ * The pending transponders are kept per LNB band / polarization, each list by frequency: a tuner pops the head of its group while it has some.
+ */
+
+typedef struct _ScanQueue ScanQueue;
+
+// The file keeps its entries, the duplicates are freed; parms: the frequency shift
+ScanQueue * scan_queue_new ( struct dvb_file *, struct dvb_v5_fe_parms *parms );
+
+void scan_queue_free ( ScanQueue * );
+
+// The next transponder to scan, num: its number in this scan; waits while another tuner may add some. NULL: done or stopped
+// group: of the last transponder of this tuner ( 0: none ), the next one's on return
+struct dvb_entry * scan_queue_next ( ScanQueue *, uint32_t *group, uint32_t *freq, uint32_t *num );
+
+// Every scan_queue_next ( ) ends here; handler: the NIT transponders of entry are queued ( NULL: none )
+void scan_queue_done ( ScanQueue *, struct dvb_v5_fe_parms *parms, struct dvb_v5_descriptors *handler, struct dvb_entry *entry );
+
+void scan_queue_stop ( ScanQueue * );
+
+// The band / polarization switches of a satellite scan: in file order and done
+// switch_us: the measured cost of one switch ( scan_lock_switch ( ) ), the time saved; -1 not measured
+void scan_queue_report ( ScanQueue *, int64_t switch_us );
+
+// The entries of src go to the end of dst ( NULL: src itself ), src is freed
+void scan_file_append ( struct dvb_file **dst, struct dvb_file *src );
+
+// The channels of every tuner in one file, a service found by two tuners once; the tuner files are freed
+struct dvb_file * scan_merge ( struct dvb_file *files[], uint8_t n );
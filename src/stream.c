@@ -0,0 +1,675 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#define _GNU_SOURCE
+
+#define STREAM_BLOCK ( 348 * TS_SIZE ) // ~ 64 KB, one HTTP chunk
+#define STREAM_RING  4 // MB per TCP client
+#define STREAM_IOV   16 // blocks per sendmsg ( )
+#define STREAM_REQ   2048
+#define MAX_EVENTS   16
+
+#include "ts.h"
+#include "ring.h"
+#include "rtp.h"
+#include "stream.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+enum stream_type
+{
+	STREAM_HTTP,
+	STREAM_HTTP_RAW, // HTTP/1.0: no chunked encoding
+	STREAM_RTP,
+	STREAM_UDP
+};
+
+typedef struct _StreamClient StreamClient;
+
+struct _StreamClient
+{
+	int fd;
+	uint8_t type;
+	gboolean stop;   // UDP: unsubscribe
+	int64_t seen;    // UDP: the last request, us
+
+	struct sockaddr_in addr;
+	Rtp *rtp;
+
+	Ring *ring;      // TCP
+	uint32_t off;    // sent of the tail block, chunk header included
+	gboolean sync;   // start or drop: resume at a random access point
+};
+
+struct _Stream
+{
+	char *path;
+	char *uri;
+
+	GMutex lock;
+	GSList *pending; // server thread -> writer
+
+	GSList *clients; // writer only
+	uint32_t n_clients;
+	uint64_t drop;
+};
+
+typedef struct _StreamConn StreamConn;
+
+// HTTP request not complete yet
+struct _StreamConn
+{
+	int fd;
+	uint32_t len;
+	char req[STREAM_REQ];
+};
+
+typedef struct _StreamServer StreamServer;
+
+struct _StreamServer
+{
+	int epoll_fd;
+	int tcp_fd;
+	int udp_fd;
+	uint16_t port;
+
+	GMutex lock;
+	GHashTable *streams; // path -> Stream
+};
+
+static GMutex server_lock;
+static StreamServer *server = NULL;
+
+static const char http_ok[] = "HTTP/1.1 200 OK\r\nContent-Type: video/mp2t\r\nCache-Control: no-cache\r\nConnection: close\r\n";
+
+// ***** Clients *****
+
+static void stream_client_free ( StreamClient *c )
+{
+	// UDP clients send through the server socket
+	if ( c->ring ) { close ( c->fd ); ring_free ( c->ring ); }
+
+	if ( c->rtp ) rtp_free ( c->rtp );
+
+	free ( c );
+}
+
+static StreamClient * stream_client_new ( int fd, uint8_t type, const struct sockaddr_in *addr )
+{
+	StreamClient *c = g_new0 ( StreamClient, 1 );
+
+	c->fd = fd;
+	c->type = type;
+	c->sync = TRUE;
+
+	if ( addr ) { c->addr = *addr; c->seen = g_get_monotonic_time (); }
+
+	if ( type == STREAM_RTP || type == STREAM_UDP ) { c->rtp = rtp_new ( type == STREAM_RTP ); return c; }
+
+	c->ring = ring_new ( STREAM_RING * 1024 * 1024 / STREAM_BLOCK, STREAM_BLOCK );
+
+	if ( !c->ring ) { close ( fd ); free ( c ); return NULL; }
+
+	return c;
+}
+
+static uint32_t stream_chunk_hdr ( const StreamClient *c, uint32_t len, char *hdr )
+{
+	if ( c->type != STREAM_HTTP ) return 0;
+
+	return (uint32_t)sprintf ( hdr, "%x\r\n", len );
+}
+
+// FALSE: the client is gone
+static gboolean stream_client_send ( StreamClient *c )
+{
+	char hdr[STREAM_IOV][16];
+	struct iovec iov[STREAM_IOV * 3];
+
+	while ( TRUE )
+	{
+		uint8_t *buf = NULL;
+		uint32_t n = 0, k = 0, len = 0, index = 0, skip = c->off;
+		size_t size = 0;
+
+		while ( n < STREAM_IOV && ( buf = ring_peek ( c->ring, n, &len, &index ) ) )
+		{
+			uint32_t h = stream_chunk_hdr ( c, len, hdr[n] );
+
+			const uint8_t *seg[3] = { (uint8_t *)hdr[n], buf, (const uint8_t *)"\r\n" };
+			uint32_t seg_len[3] = { h, len, ( h ) ? 2 : 0 };
+
+			uint8_t s = 0; for ( s = 0; s < 3; s++ )
+			{
+				if ( skip >= seg_len[s] ) { skip -= seg_len[s]; continue; }
+
+				iov[k].iov_base = (void *)( seg[s] + skip );
+				iov[k].iov_len = seg_len[s] - skip;
+				size += iov[k++].iov_len;
+
+				skip = 0;
+			}
+
+			n++;
+		}
+
+		if ( n == 0 ) return TRUE;
+
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = k };
+
+		ssize_t w = sendmsg ( c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL );
+
+		if ( w == -1 && errno == EINTR ) continue;
+
+		if ( w == -1 ) return ( errno == EAGAIN );
+
+		// Release the blocks sent in full
+		uint64_t done = c->off + (uint64_t)w;
+
+		while ( ring_tail ( c->ring, &len ) )
+		{
+			uint32_t framed = len + stream_chunk_hdr ( c, len, hdr[0] ) + ( ( c->type == STREAM_HTTP ) ? 2 : 0 );
+
+			if ( done < framed ) break;
+
+			done -= framed;
+			ring_pop ( c->ring );
+		}
+
+		c->off = (uint32_t)done;
+
+		if ( (size_t)w < size ) return TRUE;
+	}
+
+	return TRUE;
+}
+
+// Ring full: drop the new data, the queued blocks stay whole for the chunk framing
+static void stream_client_push ( Stream *stream, StreamClient *c, const uint8_t *buf, uint32_t len )
+{
+	uint32_t off = 0;
+
+	if ( c->sync && ring_head ( c->ring ) )
+	{
+		off = ts_access_point ( buf, len );
+
+		stream->drop += off;
+		c->sync = FALSE;
+	}
+
+	while ( off < len )
+	{
+		uint8_t *head = ring_head ( c->ring );
+
+		if ( !head ) { stream->drop += len - off; c->sync = TRUE; return; }
+
+		uint32_t n = MIN ( len - off, STREAM_BLOCK );
+
+		memcpy ( head, buf + off, n );
+		ring_push ( c->ring, n );
+
+		off += n;
+	}
+}
+
+static gboolean stream_client_udp_equal ( const StreamClient *a, const StreamClient *b )
+{
+	return a->addr.sin_addr.s_addr == b->addr.sin_addr.s_addr && a->addr.sin_port == b->addr.sin_port;
+}
+
+static void stream_accept_pending ( Stream *stream )
+{
+	g_mutex_lock ( &stream->lock );
+
+	GSList *pending = stream->pending;
+	stream->pending = NULL;
+
+	g_mutex_unlock ( &stream->lock );
+
+	GSList *p = NULL; for ( p = pending; p; p = p->next )
+	{
+		StreamClient *c = (StreamClient *)p->data;
+
+		if ( c->ring ) { stream->clients = g_slist_prepend ( stream->clients, c ); continue; }
+
+		// UDP: one subscription per address; the same request renews it ( the RTP sequence goes on ), another one replaces it
+		GSList *l = stream->clients; while ( l )
+		{
+			GSList *next = l->next;
+			StreamClient *o = (StreamClient *)l->data;
+
+			if ( c && !o->ring && stream_client_udp_equal ( o, c ) )
+			{
+				if ( !c->stop && o->type == c->type ) { o->seen = c->seen; stream_client_free ( c ); c = NULL; }
+				else { stream->clients = g_slist_delete_link ( stream->clients, l ); stream_client_free ( o ); }
+			}
+
+			l = next;
+		}
+
+		if ( !c ) continue;
+
+		if ( c->stop ) stream_client_free ( c ); else stream->clients = g_slist_prepend ( stream->clients, c );
+	}
+
+	g_slist_free ( pending );
+
+	stream->n_clients = g_slist_length ( stream->clients );
+}
+
+static void stream_remove ( Stream *stream, GSList *l )
+{
+	stream_client_free ( (StreamClient *)l->data );
+
+	stream->clients = g_slist_delete_link ( stream->clients, l );
+	stream->n_clients--;
+}
+
+void stream_write ( Stream *stream, const uint8_t *buf, uint32_t len )
+{
+	stream_accept_pending ( stream );
+
+	int64_t now = g_get_monotonic_time ();
+
+	GSList *l = stream->clients; while ( l )
+	{
+		GSList *next = l->next;
+		StreamClient *c = (StreamClient *)l->data;
+
+		if ( c->ring ) { stream_client_push ( stream, c, buf, len ); l = next; continue; }
+
+		// Not renewed: the server socket is not connected, no ICMP error tells a viewer is gone
+		if ( now - c->seen > STREAM_UDP_TTL * G_USEC_PER_SEC )
+		{
+			g_message ( "%s:: %s:%u expired ", __func__, inet_ntoa ( c->addr.sin_addr ), ntohs ( c->addr.sin_port ) );
+
+			stream_remove ( stream, l );
+			l = next;
+
+			continue;
+		}
+
+		// Datagrams never wait: what the socket does not take is dropped
+		ssize_t w = rtp_send ( c->rtp, server->udp_fd, (struct sockaddr *)&c->addr, sizeof ( c->addr ), buf, len );
+
+		if ( w == -1 )
+		{
+			g_warning ( "%s:: %s: %s ", __func__, inet_ntoa ( c->addr.sin_addr ), g_strerror ( errno ) );
+
+			stream_remove ( stream, l );
+		}
+		else
+			stream->drop += len - (uint32_t)w;
+
+		l = next;
+	}
+}
+
+void stream_flush ( Stream *stream )
+{
+	stream_accept_pending ( stream );
+
+	GSList *l = stream->clients; while ( l )
+	{
+		GSList *next = l->next;
+		StreamClient *c = (StreamClient *)l->data;
+
+		if ( c->ring && !stream_client_send ( c ) ) stream_remove ( stream, l );
+
+		l = next;
+	}
+}
+
+uint32_t stream_clients ( const Stream *stream )
+{
+	return stream->n_clients;
+}
+
+uint64_t stream_drop ( const Stream *stream )
+{
+	return stream->drop;
+}
+
+const char * stream_uri ( const Stream *stream )
+{
+	return stream->uri;
+}
+
+// ***** Server *****
+
+static Stream * stream_lookup_locked ( const char *path )
+{
+	return (Stream *)g_hash_table_lookup ( server->streams, path );
+}
+
+static void stream_add_client ( const char *path, StreamClient *c )
+{
+	g_mutex_lock ( &server->lock );
+
+	Stream *stream = stream_lookup_locked ( path );
+
+	if ( stream )
+	{
+		g_mutex_lock ( &stream->lock );
+		stream->pending = g_slist_append ( stream->pending, c );
+		g_mutex_unlock ( &stream->lock );
+	}
+
+	g_mutex_unlock ( &server->lock );
+
+	if ( !stream ) stream_client_free ( c );
+}
+
+static gboolean stream_exists ( const char *path )
+{
+	g_mutex_lock ( &server->lock );
+
+	gboolean ret = ( stream_lookup_locked ( path ) != NULL );
+
+	g_mutex_unlock ( &server->lock );
+
+	return ret;
+}
+
+static void stream_conn_close ( StreamConn *conn, gboolean close_fd )
+{
+	epoll_ctl ( server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL );
+
+	if ( close_fd ) close ( conn->fd );
+
+	free ( conn );
+}
+
+static void stream_conn_reply ( StreamConn *conn, const char *status )
+{
+	g_autofree char *str = g_strdup_printf ( "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status );
+
+	if ( send ( conn->fd, str, strlen ( str ), MSG_DONTWAIT | MSG_NOSIGNAL ) == -1 ) perror ( "Stream reply" );
+
+	stream_conn_close ( conn, TRUE );
+}
+
+// "GET /path?query HTTP/1.1"
+static void stream_conn_request ( StreamConn *conn )
+{
+	char method[8] = "", path[256] = "", version[16] = "";
+
+	if ( sscanf ( conn->req, "%7s %255s %15s", method, path, version ) != 3 || path[0] != '/' ) { stream_conn_reply ( conn, "400 Bad Request" ); return; }
+
+	if ( !g_str_equal ( method, "GET" ) ) { stream_conn_reply ( conn, "405 Method Not Allowed" ); return; }
+
+	char *query = strchr ( path, '?' );
+	if ( query ) *query = 0;
+
+	if ( !stream_exists ( path ) ) { stream_conn_reply ( conn, "404 Not Found" ); return; }
+
+	gboolean chunked = !g_str_equal ( version, "HTTP/1.0" );
+
+	g_autofree char *str = g_strconcat ( http_ok, ( chunked ) ? "Transfer-Encoding: chunked\r\n\r\n" : "\r\n", NULL );
+
+	// A fresh socket takes the whole header
+	if ( send ( conn->fd, str, strlen ( str ), MSG_DONTWAIT | MSG_NOSIGNAL ) != (ssize_t)strlen ( str ) ) { stream_conn_close ( conn, TRUE ); return; }
+
+	int fd = conn->fd;
+	stream_conn_close ( conn, FALSE );
+
+	StreamClient *c = stream_client_new ( fd, ( chunked ) ? STREAM_HTTP : STREAM_HTTP_RAW, NULL );
+
+	if ( c ) stream_add_client ( path, c );
+}
+
+static void stream_conn_read ( StreamConn *conn )
+{
+	ssize_t r = read ( conn->fd, conn->req + conn->len, STREAM_REQ - 1 - conn->len );
+
+	if ( r == -1 && ( errno == EAGAIN || errno == EINTR ) ) return;
+
+	if ( r <= 0 ) { stream_conn_close ( conn, TRUE ); return; }
+
+	conn->len += (uint32_t)r;
+	conn->req[conn->len] = 0;
+
+	if ( strstr ( conn->req, "\r\n\r\n" ) || strstr ( conn->req, "\n\n" ) ) { stream_conn_request ( conn ); return; }
+
+	if ( conn->len == STREAM_REQ - 1 ) stream_conn_reply ( conn, "431 Request Header Fields Too Large" );
+}
+
+static void stream_server_accept ( StreamServer *srv )
+{
+	while ( TRUE )
+	{
+		int fd = accept4 ( srv->tcp_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+		if ( fd == -1 )
+		{
+			if ( errno == EINTR ) continue;
+			if ( errno != EAGAIN ) perror ( "Stream accept" );
+
+			return;
+		}
+
+		StreamConn *conn = g_new0 ( StreamConn, 1 );
+		conn->fd = fd;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+
+		if ( epoll_ctl ( srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == -1 ) { perror ( "Stream EPOLL_CTL_ADD" ); close ( fd ); free ( conn ); }
+	}
+}
+
+static void stream_server_udp ( StreamServer *srv )
+{
+	while ( TRUE )
+	{
+		char req[256];
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof ( addr );
+
+		ssize_t r = recvfrom ( srv->udp_fd, req, sizeof ( req ) - 1, 0, (struct sockaddr *)&addr, &addr_len );
+
+		if ( r == -1 )
+		{
+			if ( errno == EINTR ) continue;
+			if ( errno != EAGAIN ) perror ( "Stream recvfrom" );
+
+			return;
+		}
+
+		req[r] = 0;
+		g_strchomp ( req );
+
+		char *query = strchr ( req, '?' );
+		if ( query ) *query++ = 0;
+
+		if ( req[0] != '/' ) continue;
+
+		uint8_t type = ( query && g_str_equal ( query, "udp" ) ) ? STREAM_UDP : STREAM_RTP;
+
+		StreamClient *c = stream_client_new ( srv->udp_fd, type, &addr );
+
+		c->stop = ( query && g_str_equal ( query, "stop" ) );
+
+		stream_add_client ( req, c );
+	}
+}
+
+static gpointer stream_server_run ( StreamServer *srv )
+{
+	struct epoll_event events[MAX_EVENTS];
+
+	while ( TRUE )
+	{
+		int n = epoll_wait ( srv->epoll_fd, events, MAX_EVENTS, -1 );
+
+		if ( n == -1 )
+		{
+			if ( errno == EINTR ) continue;
+
+			perror ( "Stream epoll_wait" );
+
+			break;
+		}
+
+		int i = 0; for ( i = 0; i < n; i++ )
+		{
+			if ( events[i].data.ptr == &srv->tcp_fd )
+				stream_server_accept ( srv );
+			else if ( events[i].data.ptr == &srv->udp_fd )
+				stream_server_udp ( srv );
+			else
+				stream_conn_read ( (StreamConn *)events[i].data.ptr );
+		}
+	}
+
+	return NULL;
+}
+
+static int stream_socket ( int type, uint16_t port )
+{
+	int fd = socket ( AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+	if ( fd == -1 ) return -1;
+
+	int on = 1;
+	setsockopt ( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof ( on ) );
+
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons ( port ), .sin_addr.s_addr = htonl ( INADDR_LOOPBACK ) };
+
+	if ( bind ( fd, (struct sockaddr *)&addr, sizeof ( addr ) ) == -1 || ( type == SOCK_STREAM && listen ( fd, 16 ) == -1 ) ) { close ( fd ); return -1; }
+
+	return fd;
+}
+
+static gboolean stream_server_add ( StreamServer *srv, int *fd )
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = fd;
+
+	return ( epoll_ctl ( srv->epoll_fd, EPOLL_CTL_ADD, *fd, &ev ) == 0 );
+}
+
+static StreamServer * stream_server_new ( uint16_t port, const char **error )
+{
+	StreamServer *srv = g_new0 ( StreamServer, 1 );
+
+	srv->port = port;
+	srv->epoll_fd = epoll_create1 ( EPOLL_CLOEXEC );
+	srv->tcp_fd = stream_socket ( SOCK_STREAM, port );
+	srv->udp_fd = stream_socket ( SOCK_DGRAM,  port );
+
+	if ( srv->epoll_fd == -1 || srv->tcp_fd == -1 || srv->udp_fd == -1 || !stream_server_add ( srv, &srv->tcp_fd ) || !stream_server_add ( srv, &srv->udp_fd ) )
+	{
+		perror ( "Stream server" );
+		*error = "Cannot start stream server";
+
+		if ( srv->epoll_fd != -1 ) close ( srv->epoll_fd );
+		if ( srv->tcp_fd != -1 ) close ( srv->tcp_fd );
+		if ( srv->udp_fd != -1 ) close ( srv->udp_fd );
+
+		free ( srv );
+
+		return NULL;
+	}
+
+	// RTP bursts of a whole capture block
+	int size = 4 * 1024 * 1024;
+	setsockopt ( srv->udp_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof ( size ) );
+
+	g_mutex_init ( &srv->lock );
+	srv->streams = g_hash_table_new ( g_str_hash, g_str_equal );
+
+	GThread *thread = g_thread_new ( "stream-server", (GThreadFunc)stream_server_run, srv );
+	g_thread_unref ( thread );
+
+	return srv;
+}
+
+gboolean stream_server_start ( uint16_t port, const char **error )
+{
+	g_mutex_lock ( &server_lock );
+
+	if ( !server ) server = stream_server_new ( port, error );
+
+	g_mutex_unlock ( &server_lock );
+
+	return ( server ) ? TRUE : FALSE;
+}
+
+Stream * stream_new ( const char *path, const char **error )
+{
+	if ( !server ) { *error = "Stream server is not running"; return NULL; }
+
+	Stream *stream = g_new0 ( Stream, 1 );
+
+	stream->path = g_strdup ( path );
+	stream->uri  = g_strdup_printf ( "http://127.0.0.1:%u%s", server->port, path );
+
+	g_mutex_init ( &stream->lock );
+
+	g_mutex_lock ( &server->lock );
+
+	gboolean taken = g_hash_table_contains ( server->streams, path );
+
+	if ( !taken ) g_hash_table_insert ( server->streams, stream->path, stream );
+
+	g_mutex_unlock ( &server->lock );
+
+	if ( taken )
+	{
+		*error = "Stream path is taken";
+
+		g_mutex_clear ( &stream->lock );
+		free ( stream->path );
+		free ( stream->uri );
+		free ( stream );
+
+		return NULL;
+	}
+
+	return stream;
+}
+
+void stream_free ( Stream *stream )
+{
+	// Not reachable by the server anymore: the pending list is ours
+	g_mutex_lock ( &server->lock );
+	g_hash_table_remove ( server->streams, stream->path );
+	g_mutex_unlock ( &server->lock );
+
+	stream_accept_pending ( stream );
+
+	GSList *l = NULL; for ( l = stream->clients; l; l = l->next )
+	{
+		StreamClient *c = (StreamClient *)l->data;
+
+		if ( c->ring ) stream_client_send ( c );
+
+		// Last chunk: the HTTP client sees the end of the stream, not an error
+		if ( c->type == STREAM_HTTP && c->off == 0 && send ( c->fd, "0\r\n\r\n", 5, MSG_DONTWAIT | MSG_NOSIGNAL ) == -1 ) perror ( "Stream close" );
+
+		stream_client_free ( c );
+	}
+
+	g_slist_free ( stream->clients );
+	g_mutex_clear ( &stream->lock );
+
+	free ( stream->path );
+	free ( stream->uri );
+	free ( stream );
+}
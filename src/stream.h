@@ -0,0 +1,47 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+#define STREAM_PORT 8001
+#define STREAM_UDP_TTL 30 // s: a UDP subscription not renewed by its request ends
+
+/*
+ * Loopback streaming server: every client of a path is fed by one capture.
+ *   TCP: GET /path, HTTP chunked MPEG-TS ( plain for HTTP/1.0 ).
+ *   UDP: a datagram "/path" to the same port, RTP to the sender; "/path?udp" raw UDP, "/path?stop" ends it.
+ *   The sender repeats its request within STREAM_UDP_TTL: a viewer gone without "?stop" is dropped.
+ * A TCP client has its own ring: a slow one skips to the next random access point and never holds the others.
+ */
+
+typedef struct _Stream Stream;
+
+// 127.0.0.1:port, once; later calls keep the running server
+gboolean stream_server_start ( uint16_t port, const char **error );
+
+// path: "/..."; NULL if it is taken or the server is not running
+Stream * stream_new ( const char *path, const char **error );
+
+// Closes every client
+void stream_free ( Stream * );
+
+// http://127.0.0.1:port/path
+const char * stream_uri ( const Stream * );
+
+// One thread only ( the capture writer ): queue buf for every client, then send what the sockets take
+void stream_write ( Stream *, const uint8_t *buf, uint32_t len );
+
+void stream_flush ( Stream * );
+
+uint32_t stream_clients ( const Stream * );
+
+// Bytes not delivered to the clients, all of them summed
+uint64_t stream_drop ( const Stream * );
@@ -0,0 +1,335 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "ts.h"
+#include "psi.h"
+#include "ts-gen.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define GEN_PMT_PID  0x1000
+#define GEN_ES_PID   0x0100
+#define GEN_NULL_PID 0x1FFF
+
+#define GEN_SERVICES 253 // PAT in one section
+#define GEN_PIDS     32  // PMT in one packet
+#define GEN_PAT_PKT  6
+
+#define GEN_PSI_HZ   10
+#define GEN_PCR_HZ   25
+
+struct _TsGen
+{
+	uint16_t services;
+	uint16_t pids;     // per service
+	uint32_t rate;     // packets per second
+
+	uint32_t cc_ppm;
+	uint32_t tei_ppm;
+	uint32_t null_pct;
+
+	uint8_t *psi;      // PAT and PMT packets
+	uint32_t n_psi;
+	uint32_t psi_next; // n_psi: not sending
+	uint64_t psi_due;
+
+	uint64_t *pcr_due; // per service
+	uint64_t count;    // packets so far
+
+	uint32_t es_next;
+	uint32_t null_acc;
+	uint32_t rnd;
+
+	uint8_t cc[MAX_PID]; // next continuity counter
+	uint8_t payload[TS_SIZE];
+};
+
+// Long section header around len bytes of body at sec + 8; returns the section size
+static uint32_t ts_gen_section ( uint8_t *sec, uint8_t table_id, uint16_t id, uint32_t len )
+{
+	uint32_t size = 5 + len + 4;
+
+	sec[0] = table_id;
+	sec[1] = (uint8_t)( 0xB0 | ( size >> 8 ) );
+	sec[2] = (uint8_t)size;
+	sec[3] = (uint8_t)( id >> 8 );
+	sec[4] = (uint8_t)id;
+	sec[5] = 0xC1; // version 0, current
+	sec[6] = 0;
+	sec[7] = 0;
+
+	uint32_t crc = psi_crc32 ( sec, 8 + len );
+
+	sec[8 + len]     = (uint8_t)( crc >> 24 );
+	sec[8 + len + 1] = (uint8_t)( crc >> 16 );
+	sec[8 + len + 2] = (uint8_t)( crc >> 8 );
+	sec[8 + len + 3] = (uint8_t)crc;
+
+	return 8 + len + 4;
+}
+
+static void ts_gen_packetize ( TsGen *gen, uint16_t pid, const uint8_t *sec, uint32_t len )
+{
+	uint32_t off = 0; while ( off < len )
+	{
+		uint8_t *p = gen->psi + gen->n_psi++ * TS_SIZE;
+
+		memset ( p, 0xFF, TS_SIZE );
+
+		p[0] = TS_SYNC;
+		p[1] = (uint8_t)( ( ( off == 0 ) ? 0x40 : 0 ) | ( pid >> 8 ) );
+		p[2] = (uint8_t)pid;
+		p[3] = 0x10;
+
+		uint32_t h = 4;
+		if ( off == 0 ) p[h++] = 0; // pointer_field
+
+		uint32_t k = MIN ( TS_SIZE - h, len - off );
+
+		memcpy ( p + h, sec + off, k );
+		off += k;
+	}
+}
+
+static void ts_gen_psi ( TsGen *gen )
+{
+	uint8_t sec[1024];
+
+	uint16_t s = 0, k = 0; uint32_t len = 0;
+
+	for ( s = 0; s < gen->services; s++ )
+	{
+		uint16_t pn = s + 1, pid = GEN_PMT_PID + s;
+
+		sec[8 + len++] = (uint8_t)( pn >> 8 );
+		sec[8 + len++] = (uint8_t)pn;
+		sec[8 + len++] = (uint8_t)( 0xE0 | ( pid >> 8 ) );
+		sec[8 + len++] = (uint8_t)pid;
+	}
+
+	ts_gen_packetize ( gen, 0, sec, ts_gen_section ( sec, 0x00, 1, len ) );
+
+	for ( s = 0; s < gen->services; s++ )
+	{
+		uint16_t pcr = GEN_ES_PID + s * gen->pids;
+
+		len = 0;
+
+		sec[8 + len++] = (uint8_t)( 0xE0 | ( pcr >> 8 ) );
+		sec[8 + len++] = (uint8_t)pcr;
+		sec[8 + len++] = 0xF0; // program_info_length 0
+		sec[8 + len++] = 0x00;
+
+		for ( k = 0; k < gen->pids; k++ )
+		{
+			uint16_t pid = pcr + k;
+
+			sec[8 + len++] = ( k == 0 ) ? 0x1B : 0x0F; // H.264, AAC
+			sec[8 + len++] = (uint8_t)( 0xE0 | ( pid >> 8 ) );
+			sec[8 + len++] = (uint8_t)pid;
+			sec[8 + len++] = 0xF0;
+			sec[8 + len++] = 0x00;
+		}
+
+		ts_gen_packetize ( gen, GEN_PMT_PID + s, sec, ts_gen_section ( sec, 0x02, s + 1, len ) );
+	}
+}
+
+static inline uint32_t ts_gen_rand ( TsGen *gen )
+{
+	// xorshift32: cheap and the same stream on every run
+	gen->rnd ^= gen->rnd << 13;
+	gen->rnd ^= gen->rnd >> 17;
+	gen->rnd ^= gen->rnd << 5;
+
+	return gen->rnd;
+}
+
+static inline gboolean ts_gen_hit ( TsGen *gen, uint32_t ppm )
+{
+	return ppm && ts_gen_rand ( gen ) % 1000000 < ppm;
+}
+
+static void ts_gen_pcr ( TsGen *gen, uint8_t *p )
+{
+	uint64_t pcr = ( gen->count / gen->rate ) * TS_PCR_HZ + ( gen->count % gen->rate ) * TS_PCR_HZ / gen->rate;
+
+	uint64_t base = ( pcr / 300 ) & ( ( 1ULL << 33 ) - 1 );
+	uint16_t ext  = (uint16_t)( pcr % 300 );
+
+	p[3] |= 0x20; // adaptation_field
+	p[4] = 7;
+	p[5] = 0x10;  // PCR_flag
+	p[6] = (uint8_t)( base >> 25 );
+	p[7] = (uint8_t)( base >> 17 );
+	p[8] = (uint8_t)( base >> 9 );
+	p[9] = (uint8_t)( base >> 1 );
+	p[10] = (uint8_t)( ( ( base & 1 ) << 7 ) | 0x7E | ( ext >> 8 ) );
+	p[11] = (uint8_t)ext;
+
+	memcpy ( p + 12, gen->payload, TS_SIZE - 12 );
+}
+
+static void ts_gen_es ( TsGen *gen, uint8_t *p )
+{
+	uint32_t i = gen->es_next;
+	gen->es_next = ( i + 1 ) % ( (uint32_t)gen->services * gen->pids );
+
+	uint16_t s = (uint16_t)( i / gen->pids ), pid = (uint16_t)( GEN_ES_PID + i );
+
+	uint8_t cc = gen->cc[pid];
+
+	// Gap: one counter value is skipped
+	if ( ts_gen_hit ( gen, gen->cc_ppm ) ) cc = ( cc + 1 ) & 0x0F;
+
+	gen->cc[pid] = ( cc + 1 ) & 0x0F;
+
+	p[0] = TS_SYNC;
+	p[1] = (uint8_t)( pid >> 8 );
+	p[2] = (uint8_t)pid;
+	p[3] = 0x10 | cc;
+
+	if ( i % gen->pids == 0 && gen->count >= gen->pcr_due[s] )
+	{
+		ts_gen_pcr ( gen, p );
+		gen->pcr_due[s] = gen->count + gen->rate / GEN_PCR_HZ;
+	}
+	else
+		memcpy ( p + 4, gen->payload, TS_SIZE - 4 );
+
+	if ( ts_gen_hit ( gen, gen->tei_ppm ) ) p[1] |= 0x80;
+}
+
+void ts_gen_fill ( TsGen *gen, uint8_t *buf, uint32_t n )
+{
+	uint32_t i = 0; for ( i = 0; i < n; i++, buf += TS_SIZE, gen->count++ )
+	{
+		if ( gen->psi_next == gen->n_psi && gen->count >= gen->psi_due )
+		{
+			gen->psi_next = 0;
+			gen->psi_due += gen->rate / GEN_PSI_HZ;
+		}
+
+		if ( gen->psi_next < gen->n_psi )
+		{
+			memcpy ( buf, gen->psi + gen->psi_next++ * TS_SIZE, TS_SIZE );
+
+			uint16_t pid = (uint16_t)( ( ( buf[1] & 0x1F ) << 8 ) | buf[2] );
+
+			buf[3] = (uint8_t)( ( buf[3] & 0xF0 ) | gen->cc[pid] );
+			gen->cc[pid] = ( gen->cc[pid] + 1 ) & 0x0F;
+
+			continue;
+		}
+
+		gen->null_acc += gen->null_pct;
+
+		if ( gen->null_acc >= 100 )
+		{
+			gen->null_acc -= 100;
+
+			memset ( buf, 0xFF, TS_SIZE );
+
+			buf[0] = TS_SYNC;
+			buf[1] = GEN_NULL_PID >> 8;
+			buf[2] = GEN_NULL_PID & 0xFF;
+			buf[3] = 0x10;
+
+			continue;
+		}
+
+		ts_gen_es ( gen, buf );
+	}
+}
+
+uint32_t ts_gen_rate ( const TsGen *gen )
+{
+	return gen->rate;
+}
+
+static const char * ts_gen_check ( uint32_t services, uint32_t pids, uint32_t rate, uint32_t cc, uint32_t tei, uint32_t null )
+{
+	if ( services < 1 || services > GEN_SERVICES ) return "Generator: services 1 - 253";
+
+	if ( pids < 1 || pids > GEN_PIDS ) return "Generator: pids 1 - 32";
+
+	if ( services * pids > GEN_PMT_PID - GEN_ES_PID ) return "Generator: too many PIDs";
+
+	if ( cc > 1000000 || tei > 1000000 || null > 99 ) return "Generator: cc, tei in ppm, null in %";
+
+	// PSI has to fit in the stream
+	if ( rate / GEN_PSI_HZ < 2 * ( GEN_PAT_PKT + services ) ) return "Generator: bitrate too low";
+
+	return NULL;
+}
+
+TsGen * ts_gen_new ( const char *spec, const char **error )
+{
+	uint32_t services = 1, pids = 2, cc = 0, tei = 0, null = 0;
+	double mbit = 20;
+
+	*error = NULL;
+
+	char **list = g_strsplit ( spec, ",", 0 );
+
+	uint8_t i = 0; for ( i = 0; list[i] && !*error; i++ )
+	{
+		if ( !list[i][0] ) continue;
+
+		char *val = strchr ( list[i], '=' );
+
+		if ( !val ) { *error = "Generator: expected key=value"; break; }
+
+		*val++ = '\0';
+
+		if ( g_str_equal ( list[i], "services" ) ) services = (uint32_t)strtoul ( val, NULL, 10 );
+		else if ( g_str_equal ( list[i], "pids" ) ) pids = (uint32_t)strtoul ( val, NULL, 10 );
+		else if ( g_str_equal ( list[i], "mbit" ) ) mbit = g_ascii_strtod ( val, NULL );
+		else if ( g_str_equal ( list[i], "cc"   ) ) cc   = (uint32_t)strtoul ( val, NULL, 10 );
+		else if ( g_str_equal ( list[i], "tei"  ) ) tei  = (uint32_t)strtoul ( val, NULL, 10 );
+		else if ( g_str_equal ( list[i], "null" ) ) null = (uint32_t)strtoul ( val, NULL, 10 );
+		else *error = "Generator: unknown key";
+	}
+
+	g_strfreev ( list );
+
+	uint32_t rate = ( mbit > 0 && mbit <= 100000 ) ? (uint32_t)( mbit * 1000000 / ( TS_SIZE * 8 ) ) : 0;
+
+	if ( !*error ) *error = ts_gen_check ( services, pids, rate, cc, tei, null );
+
+	if ( *error ) { g_warning ( "%s:: %s", __func__, *error ); return NULL; }
+
+	TsGen *gen = g_new0 ( TsGen, 1 );
+
+	gen->services = (uint16_t)services;
+	gen->pids = (uint16_t)pids;
+	gen->rate = rate;
+	gen->cc_ppm = cc;
+	gen->tei_ppm = tei;
+	gen->null_pct = null;
+	gen->rnd = 0x2545F491;
+
+	gen->psi = g_malloc ( ( GEN_PAT_PKT + services ) * TS_SIZE );
+	ts_gen_psi ( gen );
+	gen->psi_next = gen->n_psi;
+
+	gen->pcr_due = g_new0 ( uint64_t, services );
+
+	uint16_t k = 0; for ( k = 0; k < TS_SIZE; k++ ) gen->payload[k] = (uint8_t)k;
+
+	return gen;
+}
+
+void ts_gen_free ( TsGen *gen )
+{
+	free ( gen->pcr_due );
+	free ( gen->psi );
+	free ( gen );
+}
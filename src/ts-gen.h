@@ -0,0 +1,33 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Synthetic transport stream: PAT / PMT every 100 ms, N services with M PIDs each,
+ * PCR on the first PID of every service, optional null padding and injected errors.
+ *
+ * spec: comma separated key=value, all optional
+ *   services=1  pids=2 ( per service )  mbit=20
+ *   cc=PPM ( continuity gaps )  tei=PPM ( transport errors )  null=PCT ( null packets )
+ */
+
+typedef struct _TsGen TsGen;
+
+TsGen * ts_gen_new ( const char *spec, const char **error );
+
+// Packets per second at the target bitrate
+uint32_t ts_gen_rate ( const TsGen * );
+
+// The next n packets of the stream
+void ts_gen_fill ( TsGen *, uint8_t *buf, uint32_t n );
+
+void ts_gen_free ( TsGen * );
@@ -0,0 +1,362 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "ts.h"
+
+#if defined ( __x86_64__ ) || ( defined ( __i386__ ) && defined ( __SSE2__ ) )
+  #define TS_X86 1
+  #include <immintrin.h>
+#endif
+
+uint32_t ts_sync ( const uint8_t *buf, uint32_t len )
+{
+	uint32_t i = 0; for ( i = 0; i < len; i++ )
+	{
+		if ( buf[i] != TS_SYNC ) continue;
+
+		// Two sync bytes one packet apart, or the last ( partial ) packet of the buffer
+		if ( i + TS_SIZE >= len || buf[i + TS_SIZE] == TS_SYNC ) return i;
+	}
+
+	return len;
+}
+
+uint32_t ts_access_point ( const uint8_t *buf, uint32_t len )
+{
+	uint32_t off = 0, pusi = len;
+
+	for ( off = 0; off + TS_SIZE <= len && buf[off] == TS_SYNC; off += TS_SIZE )
+	{
+		if ( ts_random_access ( buf + off ) ) return off;
+
+		if ( pusi == len && ( buf[off + 1] & 0x40 ) ) pusi = off;
+	}
+
+	return ( pusi < len ) ? pusi : 0;
+}
+
+static uint32_t ts_parse_scalar ( const uint8_t *buf, uint32_t i, uint32_t n, uint16_t *pids )
+{
+	for ( ; i < n; i++ )
+	{
+		const uint8_t *p = buf + i * TS_SIZE;
+
+		if ( p[0] != TS_SYNC ) break;
+
+		pids[i] = (uint16_t)( ( ( p[1] & 0x1F ) << 8 ) | p[2] );
+	}
+
+	return i;
+}
+
+static uint32_t ts_route_scalar ( const uint16_t *pids, uint32_t i, uint32_t n, const uint32_t *bitmap, uint16_t *index, uint32_t m )
+{
+	for ( ; i < n; i++ )
+	{
+		index[m] = (uint16_t)i;
+		m += ts_bitmap_test ( bitmap, pids[i] );
+	}
+
+	return m;
+}
+
+#ifdef TS_X86
+
+// The first 4 bytes of each packet: sync | pid hi | pid lo | flags ( little-endian )
+static inline __m128i ts_pid_epi32 ( __m128i v, __m128i *sync )
+{
+	*sync = _mm_cmpeq_epi32 ( _mm_and_si128 ( v, _mm_set1_epi32 ( 0xFF ) ), _mm_set1_epi32 ( TS_SYNC ) );
+
+	__m128i hi = _mm_slli_epi32 ( _mm_and_si128 ( _mm_srli_epi32 ( v, 8 ), _mm_set1_epi32 ( 0x1F ) ), 8 );
+	__m128i lo = _mm_and_si128 ( _mm_srli_epi32 ( v, 16 ), _mm_set1_epi32 ( 0xFF ) );
+
+	return _mm_or_si128 ( hi, lo );
+}
+
+static uint32_t ts_parse_sse2 ( const uint8_t *buf, uint32_t n, uint16_t *pids )
+{
+	uint32_t i = 0; for ( i = 0; i + 4 <= n; i += 4 )
+	{
+		const uint8_t *p = buf + i * TS_SIZE;
+
+		uint32_t h[4];
+		memcpy ( &h[0], p, 4 );
+		memcpy ( &h[1], p + TS_SIZE, 4 );
+		memcpy ( &h[2], p + TS_SIZE * 2, 4 );
+		memcpy ( &h[3], p + TS_SIZE * 3, 4 );
+
+		__m128i sync, pid = ts_pid_epi32 ( _mm_loadu_si128 ( (const __m128i *)h ), &sync );
+
+		if ( _mm_movemask_ps ( _mm_castsi128_ps ( sync ) ) != 0xF ) break;
+
+		// PIDs are 13 bits: the signed pack does not saturate
+		_mm_storel_epi64 ( (__m128i *)( pids + i ), _mm_packs_epi32 ( pid, pid ) );
+	}
+
+	return ts_parse_scalar ( buf, i, n, pids );
+}
+
+__attribute__ (( target ( "avx2" ) ))
+static uint32_t ts_parse_avx2 ( const uint8_t *buf, uint32_t n, uint16_t *pids )
+{
+	const __m256i off = _mm256_setr_epi32 ( 0, TS_SIZE, TS_SIZE * 2, TS_SIZE * 3, TS_SIZE * 4, TS_SIZE * 5, TS_SIZE * 6, TS_SIZE * 7 );
+
+	uint32_t i = 0; for ( i = 0; i + 8 <= n; i += 8 )
+	{
+		__m256i v = _mm256_i32gather_epi32 ( (const int *)( buf + i * TS_SIZE ), off, 1 );
+
+		__m256i sync = _mm256_cmpeq_epi32 ( _mm256_and_si256 ( v, _mm256_set1_epi32 ( 0xFF ) ), _mm256_set1_epi32 ( TS_SYNC ) );
+
+		if ( _mm256_movemask_ps ( _mm256_castsi256_ps ( sync ) ) != 0xFF ) break;
+
+		__m256i hi = _mm256_slli_epi32 ( _mm256_and_si256 ( _mm256_srli_epi32 ( v, 8 ), _mm256_set1_epi32 ( 0x1F ) ), 8 );
+		__m256i lo = _mm256_and_si256 ( _mm256_srli_epi32 ( v, 16 ), _mm256_set1_epi32 ( 0xFF ) );
+		__m256i pid = _mm256_or_si256 ( hi, lo );
+
+		_mm_storeu_si128 ( (__m128i *)( pids + i ), _mm_packs_epi32 ( _mm256_castsi256_si128 ( pid ), _mm256_extracti128_si256 ( pid, 1 ) ) );
+	}
+
+	return ts_parse_scalar ( buf, i, n, pids );
+}
+
+__attribute__ (( target ( "avx2" ) ))
+static uint32_t ts_route_avx2 ( const uint16_t *pids, uint32_t n, const uint32_t *bitmap, uint16_t *index )
+{
+	const __m256i one = _mm256_set1_epi32 ( 1 );
+	const __m256i seq = _mm256_setr_epi32 ( 0, 1, 2, 3, 4, 5, 6, 7 );
+
+	uint32_t m = 0, i = 0; for ( i = 0; i + 8 <= n; i += 8 )
+	{
+		__m256i pid = _mm256_cvtepu16_epi32 ( _mm_loadu_si128 ( (const __m128i *)( pids + i ) ) );
+
+		__m256i word = _mm256_i32gather_epi32 ( (const int *)bitmap, _mm256_srli_epi32 ( pid, 5 ), 4 );
+		__m256i bit  = _mm256_and_si256 ( _mm256_srlv_epi32 ( word, _mm256_and_si256 ( pid, _mm256_set1_epi32 ( 31 ) ) ), one );
+
+		uint32_t mask = (uint32_t)_mm256_movemask_ps ( _mm256_castsi256_ps ( _mm256_cmpeq_epi32 ( bit, one ) ) );
+
+		if ( mask == 0 ) continue;
+
+		if ( mask == 0xFF )
+		{
+			__m256i idx = _mm256_add_epi32 ( seq, _mm256_set1_epi32 ( (int)i ) );
+
+			_mm_storeu_si128 ( (__m128i *)( index + m ), _mm_packs_epi32 ( _mm256_castsi256_si128 ( idx ), _mm256_extracti128_si256 ( idx, 1 ) ) );
+			m += 8;
+
+			continue;
+		}
+
+		while ( mask ) { index[m++] = (uint16_t)( i + (uint32_t)__builtin_ctz ( mask ) ); mask &= mask - 1; }
+	}
+
+	return ts_route_scalar ( pids, i, n, bitmap, index, m );
+}
+
+#endif
+
+uint32_t ts_parse ( const uint8_t *buf, uint32_t n, uint16_t *pids )
+{
+#ifdef TS_X86
+	if ( __builtin_cpu_supports ( "avx2" ) ) return ts_parse_avx2 ( buf, n, pids );
+
+	return ts_parse_sse2 ( buf, n, pids );
+#else
+	return ts_parse_scalar ( buf, 0, n, pids );
+#endif
+}
+
+uint32_t ts_route ( const uint16_t *pids, uint32_t n, const uint32_t *bitmap, uint16_t *index )
+{
+#ifdef TS_X86
+	if ( __builtin_cpu_supports ( "avx2" ) ) return ts_route_avx2 ( pids, n, bitmap, index );
+#endif
+
+	return ts_route_scalar ( pids, 0, n, bitmap, index, 0 );
+}
+
+uint8_t ts_simd ( void )
+{
+#ifdef TS_X86
+	return ( __builtin_cpu_supports ( "avx2" ) ) ? TS_SIMD_AVX2 : TS_SIMD_SSE2;
+#else
+	return TS_SIMD_NONE;
+#endif
+}
+
+uint32_t ts_parse_simd ( uint8_t simd, const uint8_t *buf, uint32_t n, uint16_t *pids )
+{
+#ifdef TS_X86
+	if ( simd == TS_SIMD_AVX2 ) return ts_parse_avx2 ( buf, n, pids );
+	if ( simd == TS_SIMD_SSE2 ) return ts_parse_sse2 ( buf, n, pids );
+#endif
+
+	return ts_parse_scalar ( buf, 0, n, pids );
+}
+
+// No SSE2 version: the gather of the bitmap words needs AVX2
+uint32_t ts_route_simd ( uint8_t simd, const uint16_t *pids, uint32_t n, const uint32_t *bitmap, uint16_t *index )
+{
+#ifdef TS_X86
+	if ( simd == TS_SIMD_AVX2 ) return ts_route_avx2 ( pids, n, bitmap, index );
+#endif
+
+	return ts_route_scalar ( pids, 0, n, bitmap, index, 0 );
+}
+
+TsCheck * ts_check_new ( void )
+{
+	TsCheck *chk = g_new0 ( TsCheck, 1 );
+
+	memset ( chk->cc, 0xFF, sizeof ( chk->cc ) );
+
+	return chk;
+}
+
+static void ts_check_window ( TsCheck *chk )
+{
+	uint64_t scale = (uint64_t)TS_SIZE * 8 * TS_PCR_HZ;
+
+	uint32_t pid = 0; for ( pid = 0; pid < MAX_PID; pid++ )
+		chk->rate[pid] = (uint32_t)MIN ( chk->packets[pid] * scale / (uint64_t)chk->win_ticks, G_MAXUINT32 );
+
+	chk->rate_all = (uint32_t)MIN ( ( chk->pos - chk->win_pos ) * scale / (uint64_t)chk->win_ticks, G_MAXUINT32 );
+
+	uint8_t c = 0; for ( c = 0; c < chk->n_clock; c++ )
+	{
+		TsClock *clk = &chk->clock[c];
+
+		clk->interval = clk->interval_max;
+		clk->jitter = clk->jitter_max;
+		clk->interval_max = clk->jitter_max = 0;
+	}
+
+	memset ( chk->packets, 0, sizeof ( chk->packets ) );
+	chk->win_pos = chk->pos;
+	chk->win_ticks = 0;
+	chk->rate_seq++;
+}
+
+static void ts_check_pcr ( TsCheck *chk, uint16_t pid, int64_t pcr, gboolean disc )
+{
+	TsClock *clk = NULL;
+
+	uint8_t c = 0; for ( c = 0; c < chk->n_clock && !clk; c++ ) if ( chk->clock[c].pid == pid ) clk = &chk->clock[c];
+
+	if ( !clk && chk->n_clock == TS_CLOCKS ) return;
+
+	if ( !clk ) { clk = &chk->clock[chk->n_clock++]; clk->pid = pid; clk->pcr = -1; }
+
+	gboolean first = ( clk->pcr == -1 || disc );
+	int64_t d = pcr - clk->pcr;
+
+	if ( d < 0 && clk->pcr > TS_PCR_MAX - TS_PCR_HZ ) d += TS_PCR_MAX;
+
+	// ISO 13818-1: 100 ms at most between PCRs
+	if ( !first && ( d <= 0 || d > TS_PCR_HZ / 10 ) ) clk->disc++;
+
+	if ( first || d > TS_PCR_HZ / 10 ) d = 0;
+
+	if ( d > 0 )
+	{
+		clk->interval_max = MAX ( clk->interval_max, (uint32_t)( d / ( TS_PCR_HZ / 1000000 ) ) );
+
+		if ( chk->rate_all )
+		{
+			int64_t expect = (int64_t)( ( chk->pos - clk->pos ) * TS_SIZE * 8 * TS_PCR_HZ / chk->rate_all );
+			int64_t jitter = ( d > expect ) ? d - expect : expect - d;
+
+			clk->jitter_max = (uint32_t)MIN ( MAX ( clk->jitter_max, jitter * 1000 / ( TS_PCR_HZ / 1000000 ) ), G_MAXUINT32 );
+		}
+	}
+
+	if ( clk == &chk->clock[0] )
+	{
+		// A broken clock starts the window again
+		if ( d <= 0 ) { memset ( chk->packets, 0, sizeof ( chk->packets ) ); chk->win_pos = chk->pos; chk->win_ticks = 0; }
+
+		if ( d > 0 ) chk->win_ticks += d;
+
+		if ( chk->win_ticks >= TS_PCR_HZ ) ts_check_window ( chk );
+	}
+
+	clk->pcr = pcr;
+	clk->pos = chk->pos;
+}
+
+void ts_check ( TsCheck *chk, const uint8_t *pkt, uint32_t n )
+{
+	uint32_t i = 0; for ( i = 0; i < n; i++, pkt += TS_SIZE )
+	{
+		uint16_t pid = (uint16_t)( ( ( pkt[1] & 0x1F ) << 8 ) | pkt[2] );
+
+		chk->packets[pid]++;
+		chk->pos++;
+
+		// The rest of the header can not be trusted
+		if ( pkt[1] & 0x80 ) { chk->tei[pid]++; chk->n_tei++; chk->cc[pid] = 0xFF; continue; }
+
+		if ( pid == 0x1FFF ) continue;
+
+		if ( pkt[3] & 0xC0 ) { chk->scrambled[pid]++; chk->n_scrambled++; }
+
+		uint8_t afc = ( pkt[3] >> 4 ) & 3, cc = pkt[3] & 0x0F, last = chk->cc[pid];
+
+		// discontinuity_indicator
+		gboolean disc = ( afc & 2 ) && pkt[4] && ( pkt[5] & 0x80 );
+
+		if ( disc ) last = 0xFF;
+
+		int64_t pcr = ( afc & 2 ) ? ts_pcr ( pkt ) : -1;
+
+		if ( pcr != -1 ) ts_check_pcr ( chk, pid, pcr, disc );
+
+		if ( last != 0xFF )
+		{
+			// The counter only moves with a payload; one duplicate packet is allowed
+			uint8_t expect = ( afc & 1 ) ? ( last + 1 ) & 0x0F : last;
+
+			if ( cc != expect && !( ( afc & 1 ) && cc == last ) ) { chk->cc_error[pid]++; chk->n_cc_error++; }
+		}
+
+		chk->cc[pid] = cc;
+	}
+}
+
+void ts_check_buf ( TsCheck *chk, const uint8_t *buf, uint32_t len )
+{
+	uint32_t off = 0;
+
+	if ( chk->part_len )
+	{
+		off = MIN ( TS_SIZE - chk->part_len, len );
+
+		memcpy ( chk->part + chk->part_len, buf, off );
+		chk->part_len += off;
+
+		if ( chk->part_len < TS_SIZE ) return;
+
+		if ( chk->part[0] == TS_SYNC ) ts_check ( chk, chk->part, 1 );
+
+		chk->part_len = 0;
+	}
+
+	while ( off + TS_SIZE <= len )
+	{
+		if ( buf[off] != TS_SYNC ) { off += 1 + ts_sync ( buf + off + 1, len - off - 1 ); continue; }
+
+		ts_check ( chk, buf + off, 1 );
+		off += TS_SIZE;
+	}
+
+	if ( off < len && buf[off] == TS_SYNC )
+	{
+		chk->part_len = len - off;
+		memcpy ( chk->part, buf + off, chk->part_len );
+	}
+}
@@ -0,0 +1,133 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+#define TS_SIZE  188
+#define TS_SYNC  0x47
+#define MAX_PID  8192
+
+#define TS_PCR_HZ  27000000
+#define TS_PCR_MAX ( ( (int64_t)1 << 33 ) * 300 ) // wraps after ~ 26.5 h
+#define TS_CLOCKS  16 // PCR PIDs followed by a TsCheck
+
+/*
+ * Transport stream packet kernels for the software demux.
+ * A PID set is a bitmap of MAX_PID bits ( MAX_PID / 32 words ).
+ */
+
+static inline gboolean ts_bitmap_test ( const uint32_t *bitmap, uint16_t pid )
+{
+	return ( bitmap[pid >> 5] >> ( pid & 31 ) ) & 1;
+}
+
+static inline void ts_bitmap_set ( uint32_t *bitmap, uint16_t pid )
+{
+	bitmap[pid >> 5] |= 1u << ( pid & 31 );
+}
+
+// random_access_indicator: a decoder can start here
+static inline gboolean ts_random_access ( const uint8_t *pkt )
+{
+	return ( pkt[3] & 0x20 ) && pkt[4] && ( pkt[5] & 0x40 );
+}
+
+// adaptation_field with PCR_flag: 27 MHz, else -1
+static inline int64_t ts_pcr ( const uint8_t *pkt )
+{
+	if ( !( pkt[3] & 0x20 ) || pkt[4] < 7 || !( pkt[5] & 0x10 ) ) return -1;
+
+	int64_t base = ( (int64_t)pkt[6] << 25 ) | ( pkt[7] << 17 ) | ( pkt[8] << 9 ) | ( pkt[9] << 1 ) | ( pkt[10] >> 7 );
+	int64_t ext  = ( ( pkt[10] & 1 ) << 8 ) | pkt[11];
+
+	return base * 300 + ext;
+}
+
+typedef struct _TsClock TsClock;
+
+// A program clock ( PCR PID ); maxima of the current window, results of the last one
+struct _TsClock
+{
+	uint16_t pid;
+	int64_t  pcr;  // last, -1: none yet
+	uint64_t pos;  // packet of the last PCR
+
+	uint32_t interval_max; // us
+	uint32_t jitter_max;   // ns
+	uint32_t interval;
+	uint32_t jitter;
+	uint32_t disc; // PCRs > 100 ms apart or going back, without discontinuity_indicator
+};
+
+typedef struct _TsCheck TsCheck;
+
+// Inline error accounting, indexed by PID
+struct _TsCheck
+{
+	uint8_t  cc[MAX_PID]; // last continuity counter, 0xFF: not seen yet
+
+	uint32_t cc_error[MAX_PID];
+	uint32_t tei[MAX_PID];
+	uint32_t scrambled[MAX_PID];
+
+	uint64_t n_cc_error;
+	uint64_t n_tei;
+	uint64_t n_scrambled;
+
+	// Bitrates timed by the PCR of clock[0]: packets counted over ~ 1 s of stream time
+	uint64_t pos;
+	uint32_t packets[MAX_PID];
+	uint32_t rate[MAX_PID]; // bps, last window
+	uint32_t rate_all;
+	uint32_t rate_seq;      // windows closed
+	uint64_t win_pos;
+	int64_t  win_ticks;
+
+	uint8_t  n_clock;
+	TsClock  clock[TS_CLOCKS];
+
+	uint8_t  part[TS_SIZE]; // packet cut by the end of the last buffer
+	uint32_t part_len;
+};
+
+// Offset of the first packet in buf, len if there is none
+uint32_t ts_sync ( const uint8_t *buf, uint32_t len );
+
+// Aligned buf: offset of the first random access point, else of the first PES start, else 0
+uint32_t ts_access_point ( const uint8_t *buf, uint32_t len );
+
+// PIDs of up to n packets; stops at the first packet without sync byte and returns the count
+uint32_t ts_parse ( const uint8_t *buf, uint32_t n, uint16_t *pids );
+
+// Indexes of the packets whose PID is in bitmap; returns the count
+uint32_t ts_route ( const uint16_t *pids, uint32_t n, const uint32_t *bitmap, uint16_t *index );
+
+enum TsSimd { TS_SIMD_NONE, TS_SIMD_SSE2, TS_SIMD_AVX2 };
+
+// The best level of this CPU, the one ts_parse ( ) and ts_route ( ) use
+uint8_t ts_simd ( void );
+
+// ts_parse ( ), ts_route ( ) on a given level ( up to ts_simd ( ) ): for the benchmark
+uint32_t ts_parse_simd ( uint8_t simd, const uint8_t *buf, uint32_t n, uint16_t *pids );
+uint32_t ts_route_simd ( uint8_t simd, const uint16_t *pids, uint32_t n, const uint32_t *bitmap, uint16_t *index );
+
+TsCheck * ts_check_new ( void );
+
+/*
+ * PCR jitter is the distance of a PCR from where the packet position puts it at the window's rate:
+ * the PCR accuracy of a constant rate stream ( a whole mux ), an upper bound on a filtered service.
+ */
+
+// n consecutive packets
+void ts_check ( TsCheck *, const uint8_t *pkt, uint32_t n );
+
+// Packets of a raw read, in any alignment
+void ts_check_buf ( TsCheck *, const uint8_t *buf, uint32_t len );
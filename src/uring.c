@@ -0,0 +1,217 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+
+struct _Uring
+{
+	int ring_fd;
+	int fd;
+
+	gboolean fixed;
+
+	uint32_t *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+	uint32_t *cq_head, *cq_tail, *cq_mask;
+
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+
+	uint32_t to_submit;
+};
+
+static int uring_setup ( uint32_t entries, struct io_uring_params *p )
+{
+	return (int)syscall ( __NR_io_uring_setup, entries, p );
+}
+
+static int uring_enter ( int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags )
+{
+	return (int)syscall ( __NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0 );
+}
+
+static int uring_register ( int ring_fd, uint32_t opcode, const void *arg, uint32_t nr_args )
+{
+	return (int)syscall ( __NR_io_uring_register, ring_fd, opcode, arg, nr_args );
+}
+
+void uring_free ( Uring *ur )
+{
+	if ( ur->sqes   ) munmap ( ur->sqes,   ur->sqes_size );
+	if ( ur->cq_ptr ) munmap ( ur->cq_ptr, ur->cq_size   );
+	if ( ur->sq_ptr ) munmap ( ur->sq_ptr, ur->sq_size   );
+
+	close ( ur->ring_fd );
+	free ( ur );
+}
+
+Uring * uring_new ( int fd, int event_fd, uint32_t depth, uint8_t *bufs, uint32_t n_bufs, uint32_t buf_size )
+{
+	struct io_uring_params p;
+	memset ( &p, 0, sizeof(p) );
+
+	int ring_fd = uring_setup ( depth, &p );
+
+	if ( ring_fd == -1 ) { perror ( "io_uring_setup" ); return NULL; }
+
+	Uring *ur = g_new0 ( Uring, 1 );
+
+	ur->fd = fd;
+	ur->ring_fd = ring_fd;
+
+	ur->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ur->cq_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ptr = mmap ( NULL, ur->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING );
+	ur->cq_ptr = mmap ( NULL, ur->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING );
+	ur->sqes   = mmap ( NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES );
+
+	if ( ur->sq_ptr == MAP_FAILED ) ur->sq_ptr = NULL;
+	if ( ur->cq_ptr == MAP_FAILED ) ur->cq_ptr = NULL;
+	if ( ur->sqes   == MAP_FAILED ) ur->sqes   = NULL;
+
+	if ( !ur->sq_ptr || !ur->cq_ptr || !ur->sqes ) { perror ( "io_uring mmap" ); uring_free ( ur ); return NULL; }
+
+	uint8_t *sq = ur->sq_ptr, *cq = ur->cq_ptr;
+
+	ur->sq_head    = (uint32_t *)( sq + p.sq_off.head );
+	ur->sq_tail    = (uint32_t *)( sq + p.sq_off.tail );
+	ur->sq_mask    = (uint32_t *)( sq + p.sq_off.ring_mask );
+	ur->sq_entries = (uint32_t *)( sq + p.sq_off.ring_entries );
+	ur->sq_array   = (uint32_t *)( sq + p.sq_off.array );
+
+	ur->cq_head = (uint32_t *)( cq + p.cq_off.head );
+	ur->cq_tail = (uint32_t *)( cq + p.cq_off.tail );
+	ur->cq_mask = (uint32_t *)( cq + p.cq_off.ring_mask );
+	ur->cqes    = (struct io_uring_cqe *)( cq + p.cq_off.cqes );
+
+	if ( event_fd != -1 && uring_register ( ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1 ) == -1 )
+	{
+		perror ( "IORING_REGISTER_EVENTFD" );
+		uring_free ( ur );
+
+		return NULL;
+	}
+
+	if ( bufs && n_bufs )
+	{
+		struct iovec *iov = g_new0 ( struct iovec, n_bufs );
+
+		uint32_t i = 0; for ( i = 0; i < n_bufs; i++ )
+		{
+			iov[i].iov_base = bufs + (size_t)i * buf_size;
+			iov[i].iov_len  = buf_size;
+		}
+
+		// Pinning may fail on RLIMIT_MEMLOCK: plain IORING_OP_WRITE still works
+		ur->fixed = ( uring_register ( ring_fd, IORING_REGISTER_BUFFERS, iov, n_bufs ) == 0 );
+
+		if ( !ur->fixed ) perror ( "IORING_REGISTER_BUFFERS" );
+
+		free ( iov );
+	}
+
+	return ur;
+}
+
+gboolean uring_write ( Uring *ur, const uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data )
+{
+	uint32_t tail = *ur->sq_tail;
+	uint32_t head = __atomic_load_n ( ur->sq_head, __ATOMIC_ACQUIRE );
+
+	if ( tail - head >= *ur->sq_entries ) return FALSE;
+
+	uint32_t idx = tail & *ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[idx];
+
+	memset ( sqe, 0, sizeof(*sqe) );
+
+	sqe->opcode = ( ur->fixed && buf_index >= 0 ) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = ur->fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->buf_index = ( sqe->opcode == IORING_OP_WRITE_FIXED ) ? (uint16_t)buf_index : 0;
+	sqe->user_data = user_data;
+
+	ur->sq_array[idx] = idx;
+
+	__atomic_store_n ( ur->sq_tail, tail + 1, __ATOMIC_RELEASE );
+
+	ur->to_submit++;
+
+	return TRUE;
+}
+
+int uring_submit ( Uring *ur )
+{
+	if ( !ur->to_submit ) return 0;
+
+	int ret = uring_enter ( ur->ring_fd, ur->to_submit, 0, 0 );
+
+	if ( ret == -1 ) { if ( errno != EINTR && errno != EAGAIN && errno != EBUSY ) perror ( "io_uring_enter" ); return -1; }
+
+	ur->to_submit -= (uint32_t)ret;
+
+	return ret;
+}
+
+uint32_t uring_reap ( Uring *ur, UringDone done, gpointer data )
+{
+	uint32_t n = 0;
+	uint32_t head = *ur->cq_head;
+	uint32_t tail = __atomic_load_n ( ur->cq_tail, __ATOMIC_ACQUIRE );
+
+	while ( head != tail )
+	{
+		struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+
+		done ( cqe->user_data, cqe->res, data );
+
+		head++;
+		n++;
+	}
+
+	__atomic_store_n ( ur->cq_head, head, __ATOMIC_RELEASE );
+
+	return n;
+}
+
+#else
+
+Uring * uring_new ( G_GNUC_UNUSED int fd, G_GNUC_UNUSED int event_fd, G_GNUC_UNUSED uint32_t depth, G_GNUC_UNUSED uint8_t *bufs, G_GNUC_UNUSED uint32_t n_bufs, G_GNUC_UNUSED uint32_t buf_size )
+{
+	return NULL;
+}
+
+void uring_free ( G_GNUC_UNUSED Uring *ur ) { }
+
+gboolean uring_write ( G_GNUC_UNUSED Uring *ur, G_GNUC_UNUSED const uint8_t *buf, G_GNUC_UNUSED uint32_t len, G_GNUC_UNUSED uint64_t offset, G_GNUC_UNUSED int buf_index, G_GNUC_UNUSED uint64_t user_data )
+{
+	return FALSE;
+}
+
+int uring_submit ( G_GNUC_UNUSED Uring *ur ) { return -1; }
+
+uint32_t uring_reap ( G_GNUC_UNUSED Uring *ur, G_GNUC_UNUSED UringDone done, G_GNUC_UNUSED gpointer data ) { return 0; }
+
+#endif
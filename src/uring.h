@@ -0,0 +1,26 @@
+/*
+* Copyright 2022 Stepan Perun
+* This program is free software.
+*
+* License: Gnu General Public License GPL-2
+* file:///usr/share/common-licenses/GPL-2
+* http://www.gnu.org/licenses/gpl-2.0.html
+*/
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct _Uring Uring;
+
+typedef void ( *UringDone ) ( uint64_t, int, gpointer );
+
+Uring * uring_new ( int fd, int event_fd, uint32_t depth, uint8_t *bufs, uint32_t n_bufs, uint32_t buf_size );
+
+void uring_free ( Uring * );
+
+gboolean uring_write ( Uring *, const uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data );
+
+int uring_submit ( Uring * );
+
+uint32_t uring_reap ( Uring *, UringDone, gpointer );